@@ -0,0 +1,33 @@
+#ifndef PAUSE_H
+#define PAUSE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Why mpv is paused as one bitmask, reasons change on any thread but only one applier tells mpv
+
+struct pause_state {
+    atomic_uint reasons;
+    atomic_bool applied; // Pause state mpv was last told or reported, only written by the applier
+    uint32_t user_reason; // Reason kept while mpv was paused by someone else
+    unsigned int replies_pending; // Commands mpv has not answered yet, applier only
+
+    atomic_ulong changes; // Reasons added or cleared
+    atomic_ulong commands; // Pause commands the applier had to send
+};
+
+// False if the reason already was in that state
+bool pause_swap_reason(struct pause_state *state, uint32_t reason, bool set);
+
+// The rest is only called by the applier
+// True with the state to send if the reasons no longer match what mpv was told
+bool pause_next_command(struct pause_state *state, bool *pause);
+// mpv answered a command, true once it answered all of them and its own state should be reported
+bool pause_command_done(struct pause_state *state);
+// mpv's own pause state, changes nobody asked for are the user's, so they are never overruled
+void pause_report(struct pause_state *state, bool paused);
+// A new mpv starts unpaused with nothing in flight
+void pause_reset(struct pause_state *state);
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef POSTER_H
+#define POSTER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <wayland-client.h>
+
+// Still frames of every output kept in one memfd
+// Only the fd handed over with execv is inherited, mpvpaper and mpvpaper-holder pass it back and forth with -P <fd>
+
+#define POSTER_MAGIC 0x5250504d // "MPPR"
+#define POSTER_OUTPUT_LEN 64
+
+struct poster_image {
+    char output[POSTER_OUTPUT_LEN]; // wl_output name
+    uint32_t width, height; // In buffer pixels
+    uint32_t stride;
+    uint32_t scale;
+    uint32_t offset; // Pixels from the start of the file, in WL_SHM_FORMAT_XRGB8888
+};
+
+struct poster_header {
+    uint32_t magic;
+    uint32_t count;
+    struct poster_image images[];
+};
+
+struct poster {
+    int fd;
+    size_t size;
+    struct poster_header *header; // Mapped file
+    struct wl_shm_pool *pool;
+};
+
+// Images only need output, width, height and scale filled in
+bool poster_create(struct poster *poster, const struct poster_image *images, uint32_t count);
+bool poster_open(struct poster *poster, int fd);
+// Only the fd handed to the next program with execv should be inherited
+bool poster_set_inherit(const struct poster *poster, bool inherit);
+void *poster_pixels(const struct poster *poster, uint32_t index);
+const struct poster_image *poster_find(const struct poster *poster, const char *output);
+struct wl_buffer *poster_create_buffer(struct poster *poster, struct wl_shm *shm, const struct poster_image *image);
+void poster_finish(struct poster *poster);
+
+// Posters also serve as an on-disk cache of first frames
+bool poster_save(const struct poster *poster, const char *path);
+void poster_prune(const char *dir_path, unsigned int max_files);
+
+#endif
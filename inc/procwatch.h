@@ -0,0 +1,69 @@
+#ifndef PROCWATCH_H
+#define PROCWATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Scans /proc in-process for programs listed in the watch lists
+
+struct procwatch_entry {
+    char *key; // Name as matched against /proc/<pid>/comm or exe
+    char *name; // Name as written in the watch list
+    uint32_t hash;
+    uint32_t lists; // Bitmask of lists the name belongs to
+};
+
+struct procwatch_match {
+    pid_t pid;
+    const char *name;
+    uint32_t lists;
+};
+
+struct procwatch {
+    struct procwatch_entry *table; // Open addressing hash set
+    size_t table_size;
+    size_t entry_count;
+
+    struct procwatch_match *matches; // Filled by procwatch_scan()
+    size_t match_count;
+    size_t match_alloc;
+
+    // Cost of the last scan
+    unsigned int procs_scanned;
+    long scan_usec;
+};
+
+// Matched processes, polled through pidfds until they exit
+struct procwatch_proc {
+    pid_t pid;
+    int pidfd; // -1 if pidfds are unsupported and the process must be rescanned
+    uint32_t lists;
+    const char *name;
+    void *data; // Left to the caller, e.g. what polls the pidfd
+};
+
+struct procwatch_procs {
+    struct procwatch_proc *procs;
+    size_t count;
+    size_t alloc;
+};
+
+void procwatch_init(struct procwatch *watch);
+bool procwatch_add(struct procwatch *watch, const char *name, uint32_t lists);
+size_t procwatch_scan(struct procwatch *watch);
+void procwatch_finish(struct procwatch *watch);
+
+// Returns a pollable fd that becomes readable once pid exits or -1
+int procwatch_pidfd_open(pid_t pid);
+
+// Appends every match of the last scan not tracked yet, false if out of memory
+bool procwatch_track(struct procwatch_procs *procs, const struct procwatch *watch);
+// Closes the pidfd, the last process takes the index
+void procwatch_untrack(struct procwatch_procs *procs, size_t index);
+// Processes without a pidfd can only be found again by rescanning
+void procwatch_untrack_unwatched(struct procwatch_procs *procs);
+bool procwatch_has_unwatched(const struct procwatch_procs *procs);
+
+#endif
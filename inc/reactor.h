@@ -0,0 +1,44 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// One epoll loop for every fd mpvpaper waits on
+
+struct reactor_source;
+typedef void (*reactor_handler)(struct reactor_source *source, uint32_t events);
+
+struct reactor_source {
+    int fd;
+    reactor_handler handler; // NULL if the caller checks revents itself
+    void *data;
+
+    uint32_t revents; // Ready events of the last reactor_poll()
+    bool removed;
+    struct reactor_source *next_removed;
+};
+
+struct reactor {
+    int epoll_fd;
+
+    struct reactor_source **ready; // Filled by reactor_poll()
+    int ready_count;
+    int ready_alloc;
+    int source_count;
+
+    // Sources removed during a round are freed once nothing can point at them
+    struct reactor_source *removed;
+};
+
+bool reactor_init(struct reactor *reactor);
+struct reactor_source *reactor_add(struct reactor *reactor, int fd, uint32_t events, reactor_handler handler,
+        void *data);
+// Stops watching the fd, the caller still owns it
+void reactor_remove(struct reactor *reactor, struct reactor_source *source);
+
+// Waits like epoll_wait() and sets revents of ready sources, then reactor_dispatch() runs their handlers
+int reactor_poll(struct reactor *reactor, int timeout);
+void reactor_dispatch(struct reactor *reactor);
+
+#endif
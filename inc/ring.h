@@ -0,0 +1,32 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Lock-free queue between exactly one producer thread and one consumer thread
+
+struct ring_msg {
+    uint32_t type;
+    void *data;
+};
+
+struct ring {
+    struct ring_msg *msgs;
+    size_t mask; // Capacity - 1, the capacity is a power of two
+
+    atomic_size_t head; // Next slot to write, only moved by the producer
+    atomic_size_t tail; // Next slot to read, only moved by the consumer
+};
+
+bool ring_init(struct ring *ring, size_t capacity);
+void ring_finish(struct ring *ring);
+
+// False if the ring is full
+bool ring_push(struct ring *ring, struct ring_msg msg);
+// False if the ring is empty
+bool ring_pop(struct ring *ring, struct ring_msg *msg);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef WINDOW_H
+#define WINDOW_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Foreign toplevel state, staged per event and applied together on done
+
+struct wl_output;
+
+struct output_set {
+    struct wl_output **outputs;
+    size_t count;
+    size_t alloc;
+};
+
+struct window_state {
+    bool pending_blocking;
+    struct output_set pending_outputs;
+    bool changed;
+
+    bool is_blocking;
+    struct output_set outputs; // Outputs counted as covered by this window
+};
+
+// Adds or removes one blocking window from an output
+typedef void (*window_block_fn)(void *data, struct wl_output *output, bool blocking);
+
+// False if the output was already in the set or could not be added
+bool output_set_add(struct output_set *set, struct wl_output *output);
+void output_set_remove(struct output_set *set, struct wl_output *output);
+
+void window_output_enter(struct window_state *window, struct wl_output *output);
+void window_output_leave(struct window_state *window, struct wl_output *output);
+void window_set_blocking(struct window_state *window, bool blocking);
+// Applies everything staged since the last commit, false if nothing changed
+bool window_commit(struct window_state *window, window_block_fn block, void *data);
+// The output is gone, its proxy address may be reused
+void window_forget_output(struct window_state *window, struct wl_output *output);
+void window_finish(struct window_state *window);
+
+#endif
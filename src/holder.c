@@ -1,16 +1,22 @@
+#include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <poll.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/timerfd.h>
 #include <time.h>
 #include <unistd.h>
 
 #include "wlr-layer-shell-unstable-v1-client-protocol.h"
 #include "wlr-foreign-toplevel-management-unstable-v1-client-protocol.h"
 
+#include <poster.h>
+#include <procwatch.h>
+
 typedef unsigned int uint;
 
 struct wl_state {
@@ -33,6 +39,8 @@ struct display_output {
     struct wl_surface *surface;
     struct zwlr_layer_surface_v1 *layer_surface;
     struct wl_buffer *dummy_buffer;
+    struct wl_buffer *poster_buffer; // Last frame mpvpaper drew here
+    struct wl_callback *frame_callback;
 
     uint32_t width, height;
 
@@ -41,6 +49,8 @@ struct display_output {
 
 struct toplevel_handle_state {
     struct zwlr_foreign_toplevel_handle_v1 *handle;
+    struct wl_state *state;
+    bool pending_blocking; // Applied on done
     bool is_blocking;
 
     struct wl_list link;
@@ -50,10 +60,19 @@ static struct {
     char **argv_copy;
     char **stoplist;
     int auto_stop;
-    bool window_blocking;
+    uint blocking_windows; // Kept up to date instead of scanning every window
+} halt_info = {NULL, NULL, 0, 0};
+
+// Running stoplist programs, polled through pidfds until they exit
+static struct {
+    struct procwatch stoplist;
+    struct procwatch_procs procs;
+
+    int timer_fd;
+} watch_state = {.timer_fd = -1};
 
-    int start_time;
-} halt_info = {NULL, NULL, 0, 0, 0};
+// Handed over by mpvpaper with -P and passed back on revival
+static struct poster poster = {.fd = -1};
 
 static void revive_mpvpaper() {
     // Get the "real" cwd
@@ -69,20 +88,6 @@ static void revive_mpvpaper() {
     execv(strcat(exe_dir, "mpvpaper"), halt_info.argv_copy);
 }
 
-static void check_stoplist() {
-
-    char pid_name[512] = {0};
-
-    for (uint i=0; halt_info.stoplist[i] != NULL; i++) {
-        snprintf(pid_name, sizeof(pid_name), "pidof %s > /dev/null", halt_info.stoplist[i]);
-
-        while (!system(pid_name))
-            usleep(100000); // 0.1 sec
-    }
-    if (!halt_info.auto_stop)
-        revive_mpvpaper();
-}
-
 static void init_dummy_buffer(struct display_output *output) {
     const int WIDTH = 1, HEIGHT = 1;
 
@@ -109,44 +114,82 @@ const static struct wl_callback_listener wl_surface_frame_listener;
 static void create_surface_frame(struct display_output *output) {
 
     // Callback new frame
-    struct wl_callback *callback = wl_surface_frame(output->surface);
-    wl_callback_add_listener(callback, &wl_surface_frame_listener, output);
-    wl_surface_attach(output->surface, output->dummy_buffer, 0, 0);
+    output->frame_callback = wl_surface_frame(output->surface);
+    wl_callback_add_listener(output->frame_callback, &wl_surface_frame_listener, output);
+    if (output->poster_buffer)
+        wl_surface_attach(output->surface, output->poster_buffer, 0, 0);
+    else
+        wl_surface_attach(output->surface, output->dummy_buffer, 0, 0);
     wl_surface_damage(output->surface, 0, 0, output->width, output->height);
     wl_surface_commit(output->surface);
 }
 
-static void frame_handle_done(void *data, struct wl_callback *callback, uint32_t frame_time) {
-    wl_callback_destroy(callback);
+static bool is_blocked() {
+    return watch_state.procs.count > 0 || halt_info.blocking_windows > 0;
+}
+
+// Revive mpvpaper once nothing blocks it anymore
+static void update_holder(struct wl_state *state) {
+    if (is_blocked())
+        return;
 
-    if (halt_info.stoplist && !halt_info.window_blocking) {
-        check_stoplist();
-        // If checking stoplist and frame callback took longer than a second don't revive
-        if (frame_time - halt_info.start_time < 1000)
-            revive_mpvpaper();
-    } else if (!halt_info.window_blocking) {
+    if (!halt_info.auto_stop)
         revive_mpvpaper();
+
+    // Auto stop must see the wallpaper drawn first, the callback only arrives when visible
+    struct display_output *output;
+    wl_list_for_each(output, &state->outputs, link) {
+        if (output->layer_surface && output->width && output->height && !output->frame_callback)
+            create_surface_frame(output);
     }
+}
 
-    halt_info.start_time = frame_time;
-    create_surface_frame(data);
+static void frame_handle_done(void *data, struct wl_callback *callback, uint32_t frame_time) {
+    (void)frame_time;
+    struct display_output *output = data;
+    wl_callback_destroy(callback);
+    output->frame_callback = NULL;
+
+    // Otherwise wait for update_holder() to ask for another frame
+    if (!is_blocked())
+        revive_mpvpaper();
 }
 
 const static struct wl_callback_listener wl_surface_frame_listener = {
     .done = frame_handle_done,
 };
 
-static struct toplevel_handle_state *match_toplevel_handle(struct wl_state *wl_state,
-        struct zwlr_foreign_toplevel_handle_v1 *toplevel_handle) {
+static void scan_stoplist(struct wl_state *state) {
+    procwatch_untrack_unwatched(&watch_state.procs);
+    procwatch_scan(&watch_state.stoplist);
+    if (!procwatch_track(&watch_state.procs, &watch_state.stoplist)) {
+        fprintf(stderr, "Failed to reallocate watched processes\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Only keep scanning while nothing is watched through a pidfd
+    struct itimerspec period = {0};
+    if (procwatch_has_unwatched(&watch_state.procs) || watch_state.procs.count == 0) {
+        period.it_interval.tv_sec = 1;
+        period.it_value.tv_sec = 1;
+    }
+    timerfd_settime(watch_state.timer_fd, 0, &period, NULL);
 
-    struct toplevel_handle_state *handle_state;
-    wl_list_for_each(handle_state, &wl_state->toplevel_handles, link) {
+    update_holder(state);
+}
+
+static void handle_stoplist_exits(struct wl_state *state, const struct pollfd *fds) {
+    size_t old_count = watch_state.procs.count;
 
-        if(handle_state->handle == toplevel_handle)
-            return handle_state;
+    // Walk backwards so removal only moves already checked entries
+    for (size_t i = old_count; i-- > 0;) {
+        if (watch_state.procs.procs[i].pidfd >= 0 && fds[i].revents)
+            procwatch_untrack(&watch_state.procs, i);
     }
 
-    return NULL;
+    // Rescan to catch other instances started since the last scan
+    if (watch_state.procs.count == 0 && old_count > 0)
+        scan_stoplist(state);
 }
 
 static void toplevel_title(void *data, struct zwlr_foreign_toplevel_handle_v1 *toplevel_handle,
@@ -161,31 +204,26 @@ static void toplevel_output_enter(void *data, struct zwlr_foreign_toplevel_handl
 static void toplevel_output_leave(void *data, struct zwlr_foreign_toplevel_handle_v1 *toplevel_handle,
         struct wl_output *output) { /* NOP */ }
 
-static void check_handle_blocking(struct toplevel_handle_state *handle_state, struct wl_state *wl_state,
-        bool currently_blocking) {
+static void check_handle_blocking(struct toplevel_handle_state *handle_state, struct wl_state *wl_state) {
 
+    bool currently_blocking = handle_state->pending_blocking;
     if (handle_state->is_blocking != currently_blocking) {
         handle_state->is_blocking = currently_blocking;
 
-        bool any_blocking = false;
-        struct toplevel_handle_state *iter_handle;
-        wl_list_for_each(iter_handle, &wl_state->toplevel_handles, link) {
-            if (iter_handle->is_blocking) {
-                any_blocking = true;
-                break;
-            }
-        }
+        if (currently_blocking)
+            halt_info.blocking_windows++;
+        else
+            halt_info.blocking_windows--;
 
-        halt_info.window_blocking = any_blocking;
+        if (halt_info.blocking_windows == 0)
+            update_holder(wl_state);
     }
 }
 
 static void toplevel_state(void *data, struct zwlr_foreign_toplevel_handle_v1 *toplevel_handle,
         struct wl_array *state) {
 
-    struct wl_state *wl_state = data;
-    struct toplevel_handle_state *handle_state = match_toplevel_handle(wl_state, toplevel_handle);
-    if (!handle_state) return;
+    struct toplevel_handle_state *handle_state = data;
 
     uint32_t *s;
     bool currently_blocking = false;
@@ -202,22 +240,23 @@ static void toplevel_state(void *data, struct zwlr_foreign_toplevel_handle_v1 *t
         }
     }
 
-    check_handle_blocking(handle_state, wl_state, currently_blocking);
+    handle_state->pending_blocking = currently_blocking;
 }
 
-
-static void toplevel_done(void *data, struct zwlr_foreign_toplevel_handle_v1 *toplevel_handle) { /* NOP */ }
+static void toplevel_done(void *data, struct zwlr_foreign_toplevel_handle_v1 *toplevel_handle) {
+    struct toplevel_handle_state *handle_state = data;
+    check_handle_blocking(handle_state, handle_state->state);
+}
 
 static void toplevel_closed(void *data, struct zwlr_foreign_toplevel_handle_v1 *toplevel_handle) {
 
-    struct wl_state *wl_state = data;
+    struct toplevel_handle_state *handle_state = data;
+    struct wl_state *wl_state = handle_state->state;
 
-    struct toplevel_handle_state *handle_state = match_toplevel_handle(wl_state, toplevel_handle);
-    if (!handle_state) return;
-
-    if(handle_state->is_blocking)
-        check_handle_blocking(handle_state, wl_state, false);
+    handle_state->pending_blocking = false;
+    check_handle_blocking(handle_state, wl_state);
 
+    zwlr_foreign_toplevel_handle_v1_destroy(toplevel_handle);
     wl_list_remove(&handle_state->link);
     free(handle_state);
 }
@@ -243,11 +282,17 @@ static void toplevel_created(void *data, struct zwlr_foreign_toplevel_manager_v1
     struct wl_state *state = data;
 
     struct toplevel_handle_state *handle_state = calloc(1, sizeof(struct toplevel_handle_state));
+    if (!handle_state) {
+        zwlr_foreign_toplevel_handle_v1_destroy(toplevel_handle);
+        return;
+    }
 
     handle_state->handle = toplevel_handle;
+    handle_state->state = state;
     wl_list_insert(&state->toplevel_handles, &handle_state->link);
 
-    zwlr_foreign_toplevel_handle_v1_add_listener(handle_state->handle, &toplevel_handle_listener, state);
+    // Events find their state directly instead of searching every window
+    zwlr_foreign_toplevel_handle_v1_add_listener(handle_state->handle, &toplevel_handle_listener, handle_state);
 }
 
 static void toplevel_finished(void *data, struct zwlr_foreign_toplevel_manager_v1 *toplevel_manager) { /* NOP */ }
@@ -261,6 +306,10 @@ static void destroy_display_output(struct display_output *output) {
     if (!output) return;
 
     wl_list_remove(&output->link);
+    if (output->frame_callback)
+        wl_callback_destroy(output->frame_callback);
+    if (output->poster_buffer)
+        wl_buffer_destroy(output->poster_buffer);
     if (output->layer_surface != NULL)
         zwlr_layer_surface_v1_destroy(output->layer_surface);
     if (output->surface != NULL)
@@ -282,10 +331,17 @@ static void layer_surface_configure(void *data, struct zwlr_layer_surface_v1 *su
 
     if (width == 0 || height == 0) return;
 
-    if (halt_info.stoplist)
-        check_stoplist();
-    if (halt_info.auto_stop)
+    // Keep showing the wallpaper as a still while held
+    const struct poster_image *image = poster_find(&poster, output->name);
+    if (!output->poster_buffer && image && image->width == width * image->scale &&
+            image->height == height * image->scale) {
+        output->poster_buffer = poster_create_buffer(&poster, output->state->shm, image);
+        wl_surface_set_buffer_scale(output->surface, image->scale);
+    }
+    if (!output->frame_callback)
         create_surface_frame(output);
+
+    update_holder(output->state);
 }
 
 static void layer_surface_closed(void *data, struct zwlr_layer_surface_v1 *surface) {
@@ -483,6 +539,10 @@ static void set_stop_list() {
 
         free(stop_path);
         fclose(file);
+
+        procwatch_init(&watch_state.stoplist);
+        for (i=0; halt_info.stoplist[i] != NULL; i++)
+            procwatch_add(&watch_state.stoplist, halt_info.stoplist[i], 1);
     }
 }
 
@@ -499,6 +559,13 @@ static void parse_command_line(int argc, char **argv, struct wl_state *state) {
         {"slideshow", required_argument, NULL, 'n'},
         {"layer", required_argument, NULL, 'l'},
         {"mpv-options", required_argument, NULL, 'o'},
+        {"blit-mode", required_argument, NULL, 'b'},
+        {"hibernate", no_argument, NULL, 'k'},
+        {"unpause-delay", required_argument, NULL, 'u'},
+        {"output-threads", no_argument, NULL, 't'},
+        {"render-size", required_argument, NULL, 'r'},
+        {"dynamic-scale", no_argument, NULL, 'g'},
+        {"buffer-format", required_argument, NULL, 'c'},
         {0, 0, 0, 0}
     };
     const char *usage =
@@ -516,9 +583,10 @@ static void parse_command_line(int argc, char **argv, struct wl_state *state) {
 
 
     int auto_mode = 0;
+    int poster_fd = -1;
 
     int opt;
-    while ((opt = getopt_long(argc, argv, "hdvfpsa:n:l:o:Z:", long_options, NULL)) != -1) {
+    while ((opt = getopt_long(argc, argv, "hdvfpsa:n:l:o:b:ku:tr:gc:Z:P:", long_options, NULL)) != -1) {
 
         switch (opt) {
             case 'h':
@@ -531,9 +599,16 @@ static void parse_command_line(int argc, char **argv, struct wl_state *state) {
                 if (strcasecmp(optarg, "full") == 0) auto_mode = 2;
                 else if (strcasecmp(optarg, "max") == 0) auto_mode = 3;
                 break;
+            case 'P':
+                poster_fd = atoi(optarg);
+                break;
         }
     }
 
+    // Stays open for mpvpaper after revival
+    if (poster_fd >= 0)
+        poster_open(&poster, poster_fd);
+
     if (auto_mode != 0)
         halt_info.auto_stop = auto_mode;
 
@@ -555,6 +630,14 @@ int main(int argc, char **argv) {
     set_stop_list();
     copy_argv(argc, argv);
 
+    // Check the stoplist before any surface gets configured
+    if (halt_info.stoplist) {
+        watch_state.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+        if (watch_state.timer_fd == -1)
+            return EXIT_FAILURE;
+        scan_stoplist(&state);
+    }
+
     state.display = wl_display_connect(NULL);
     if (!state.display)
         return EXIT_FAILURE;
@@ -571,7 +654,67 @@ int main(int argc, char **argv) {
     if (wl_list_empty(&state.outputs))
         return EXIT_FAILURE;
 
-    while (wl_display_dispatch(state.display) != -1) { /* NOP */ }
+    // Main Loop
+    enum { FD_WAYLAND, FD_WATCH_TIMER, FD_WATCHED_PROCS };
+    struct pollfd *fds = NULL;
+    size_t fds_alloc = 0;
+    while (true) {
+        // Room for every pidfd of watched processes
+        size_t nfds = FD_WATCHED_PROCS + watch_state.procs.count;
+        if (nfds > fds_alloc) {
+            fds = realloc(fds, nfds * sizeof(struct pollfd));
+            if (!fds)
+                break;
+            fds_alloc = nfds;
+        }
+        fds[FD_WAYLAND].fd = wl_display_get_fd(state.display);
+        fds[FD_WAYLAND].events = POLLIN;
+        fds[FD_WATCH_TIMER].fd = watch_state.timer_fd; // Ignored by poll() when -1
+        fds[FD_WATCH_TIMER].events = POLLIN;
+        for (size_t i=0; i < watch_state.procs.count; i++) {
+            fds[FD_WATCHED_PROCS + i].fd = watch_state.procs.procs[i].pidfd;
+            fds[FD_WATCHED_PROCS + i].events = POLLIN;
+        }
+
+        // Events already queued must be dispatched before the display can be read
+        bool dispatch_failed = false;
+        while (wl_display_prepare_read(state.display) != 0) {
+            if (wl_display_dispatch_pending(state.display) == -1) {
+                dispatch_failed = true;
+                break;
+            }
+        }
+        if (dispatch_failed)
+            break;
+        if (wl_display_flush(state.display) == -1 && errno != EAGAIN) {
+            wl_display_cancel_read(state.display);
+            break;
+        }
+
+        // Sleep until a wl_display event, the stoplist timer or a stoplist program exiting
+        if (poll(fds, nfds, -1) == -1 && errno != EINTR) {
+            wl_display_cancel_read(state.display);
+            break;
+        }
+
+        if (fds[FD_WAYLAND].revents & POLLIN) {
+            wl_display_read_events(state.display);
+        } else {
+            wl_display_cancel_read(state.display);
+        }
+        if (wl_display_dispatch_pending(state.display) == -1)
+            break;
+
+        handle_stoplist_exits(&state, &fds[FD_WATCHED_PROCS]);
+
+        if (fds[FD_WATCH_TIMER].revents & POLLIN) {
+            uint64_t tmp;
+            if (read(watch_state.timer_fd, &tmp, sizeof(tmp)) == -1 && errno != EAGAIN)
+                break;
+            scan_stoplist(&state);
+        }
+    }
+    free(fds);
 
     struct display_output *output, *tmp_output;
     wl_list_for_each_safe(output, tmp_output, &state.outputs, link) { destroy_display_output(output); }
@@ -1,19 +1,26 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
-#include <poll.h>
 #include <pthread.h>
+#include <pwd.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <sys/epoll.h>
 #include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
 
 #include "wlr-layer-shell-unstable-v1-client-protocol.h"
 #include "wlr-foreign-toplevel-management-unstable-v1-client-protocol.h"
+#include "viewporter-client-protocol.h"
+#include "fractional-scale-v1-client-protocol.h"
 #include <wayland-client.h>
 #include <wayland-egl.h>
 
@@ -24,19 +31,30 @@
 #include <mpv/render_gl.h>
 
 #include <cflogprinter.h>
+#include <pause.h>
+#include <poster.h>
+#include <procwatch.h>
+#include <window.h>
+#include <reactor.h>
+#include <ring.h>
 
 typedef unsigned int uint;
 
 struct wl_state {
     struct wl_display *display;
     struct wl_compositor *compositor;
+    struct wl_shm *shm;
     struct zwlr_layer_shell_v1 *layer_shell;
+    struct wp_viewporter *viewporter; // NULL if the compositor can't scale surfaces
+    struct wp_fractional_scale_manager_v1 *fractional_scale_manager;
     struct wl_list outputs; // struct display_output::link
     struct wl_list toplevel_handles;
     char *monitor; // User selected output
     int surface_layer;
 };
 
+struct output_worker;
+
 struct display_output {
     uint32_t wl_name;
     struct wl_output *wl_output;
@@ -48,20 +66,79 @@ struct display_output {
     struct zwlr_layer_surface_v1 *layer_surface;
     struct wl_egl_window *egl_window;
     EGLSurface *egl_surface;
+    struct wl_buffer *poster_buffer; // Shown until the first frame is swapped in
+    bool poster_cached; // First frame at this size is already on disk
 
     uint32_t width, height;
-    uint32_t scale;
+    atomic_uint scale; // Set on the main thread, read when rendering
+    struct wp_viewport *viewport; // With -r, -g or fractional scaling, see update_buffer_size()
+    struct wp_fractional_scale_v1 *fractional_scale;
+    atomic_uint preferred_scale; // In 120ths, 0 until the compositor sent one
+    uint32_t buffer_width, buffer_height; // Pixels rendered, scaled to the output by the compositor
+
+    // Dynamic resolution with -g, see update_dynamic_scale()
+    double dynamic_scale; // 1.0 renders at full size
+    int64_t render_cost; // Smoothed us per render, CPU or GPU time whichever is longer
+    int64_t gpu_time; // us of the last render measured by timer queries
+    GLuint timer_queries[2][2]; // Start and end timestamps, one pair in flight while the other is read
+    bool timer_pending[2];
+    int timer_index;
+    uint32_t cost_samples; // Renders since the last step
+    uint32_t scale_steps;
 
     struct wl_list link;
+    struct wl_surface *render_surface; // Wrapper of surface sending frame callbacks to render_queue
+    struct wl_list render_link; // render_outputs, only touched on the render thread
+    struct output_worker *worker; // NULL unless drawn on its own thread with -t
 
     struct wl_callback *frame_callback;
     bool redraw_needed;
+
+    // Frame callback timing in ms, for ordering outputs by their next callback
+    uint32_t last_frame_time;
+    uint32_t frame_interval;
+    uint64_t rendered_seq; // frame_seq last drawn to this output
+
+    atomic_uint blocking_windows; // Fullscreen/maximized windows on this output
+
+    // Hidden surface detection, see check_visibility()
+    atomic_int refresh; // mHz of the current mode, 0 if unknown
+    int64_t callback_requested; // Monotonic us of the commit waiting for a frame callback, 0 if none
+    int64_t callback_latency; // Smoothed us from commit to frame callback
+    bool callback_overdue; // The compositor stopped answering, the surface is hidden
 };
 
+// Draws the shared frame onto one output with its own context, see render_on_worker()
+struct output_worker {
+    struct display_output *output;
+    pthread_t thread;
+    EGLContext context; // Shares the shared frame texture with egl_context
+    EGLSurface surface; // Stays current on the worker for its whole life
+    GLuint read_fbo;
+    int wake_fd; // Blocking, written for every job
+
+    struct ring jobs; // Render thread -> worker, see WORKER_PRESENT
+    // Set by the render thread before queueing a job
+    GLsync frame_fence; // Signals once the shared frame is drawn
+    int width, height; // Target size in pixels
+    int resize_width, resize_height;
+
+    atomic_bool busy; // A present is queued or running
+    // Set by the worker before busy is cleared
+    GLsync blit_fence; // Signals once the shared frame was read
+    bool presented;
+};
+#define WORKER_PRESENT 1
+#define WORKER_RESIZE 2
+#define WORKER_QUIT 3
+
 struct toplevel_handle_state {
     struct zwlr_foreign_toplevel_handle_v1 *handle;
+    struct wl_state *state;
     char *title;
-    bool is_blocking;
+
+    // Events are staged and only applied together on done
+    struct window_state window;
 
     struct wl_list link;
 };
@@ -69,12 +146,24 @@ struct toplevel_handle_state {
 static EGLConfig egl_config;
 static EGLDisplay egl_display;
 static EGLContext egl_context;
+static EGLint gl_version[2]; // Major and minor of egl_context, output workers get the same
 
 static mpv_handle *mpv;
 static mpv_render_context *mpv_glcontext;
 static int wakeup_fd;
+static int halt_fd = -1; // Wakes the main loop for request_stop() and request_revive()
+static int signal_fd = -1; // SIGINT, SIGQUIT and SIGTERM, blocked for every thread
+static sigset_t old_sigmask; // Restored for the holder
+static int mpv_event_fd = -1; // Written by mpv_wakeup_callback()
+static int slideshow_fd = -1;
+static int frame_timer_fd = -1; // Fires at the target time of a frame mpv handed over early
+static int unblock_timer_fd = -1; // Fires once windows stopped covering outputs for UNPAUSE_DELAY
+static int visibility_timer_fd = -1; // Fires when a frame callback is overdue
 static char *video_path;
 static char *mpv_options = "";
+static char *mpv_default_start; // "start" to return to after restoring a position
+#define MPV_REPLY_LOAD 1
+#define MPV_REPLY_PAUSE 2
 
 static struct {
     char **pauselist;
@@ -87,129 +176,946 @@ static struct {
     int auto_pause;
     int auto_stop;
 
-    bool list_paused;
-    bool auto_paused;
-    bool full_paused;
-    bool user_paused;
-    bool mpv_paused;
+    // Handled on the main loop, see request_stop() and request_revive()
+    atomic_bool stop_requested;
+    atomic_bool revive_requested;
+    atomic_bool hibernating; // Also checked by the render thread
+    bool hibernate_visible; // A frame callback arrived since the last check
+    bool window_blocking;
 
-    bool frame_ready;
-    bool stop_render_loop;
+} halt_info = {NULL, NULL, 0, NULL, NULL, 0, 0};
 
-} halt_info = {NULL, NULL, 0, NULL, NULL, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+// Why mpv is paused, only changed through set_pause_reason() and applied on the main thread
+#define PAUSE_LIST (1 << 0) // A pauselist app is running
+#define PAUSE_AUTO (1 << 1) // Frame callbacks stopped
+#define PAUSE_FULL (1 << 2) // Windows cover every output
+#define PAUSE_USER (1 << 3) // Paused through mpv itself
+static struct pause_state pause_state = {.user_reason = PAUSE_USER};
 
-static pthread_t threads[6] = {0};
-static pthread_mutex_t halt_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Which watch list a process name came from
+#define WATCH_PAUSELIST (1 << 0)
+#define WATCH_STOPLIST (1 << 1)
+static struct procwatch watch_lists;
 
+// Matched watch list processes, the data of each is the reactor source of its pidfd
+static struct {
+    struct procwatch_procs procs;
+
+    int timer_fd; // Rescan period while a list could still match something new
+} watch_state = {.timer_fd = -1};
+
+// Every fd the main loop sleeps on
+static struct reactor reactor = {.epoll_fd = -1};
+static struct reactor_source *wayland_source;
+
+// Rendering runs on its own thread, which owns the EGL context, see render_thread_main()
+static pthread_t main_thread;
+static pthread_t render_thread;
+static bool render_thread_running = false;
+static bool render_thread_quit = false; // Only touched on the render thread
+static struct wl_event_queue *render_queue; // Frame callbacks, dispatched by the render thread
+static struct reactor render_reactor = {.epoll_fd = -1};
+static struct reactor_source *render_wayland_source;
+static struct wl_list render_outputs; // Outputs with an EGL surface, struct display_output::render_link
+static struct ring render_calls; // Main thread -> render thread, see render_call()
+static struct ring render_events; // Render thread -> main thread, see send_render_event()
+static int render_call_fd = -1; // Wakes the render thread for render_calls
+static int render_done_fd = -1; // Blocking, acknowledges each render call
+static int render_event_fd = -1; // Wakes the main loop for render_events
+static int worker_done_fd = -1; // Wakes the render thread once an output worker presented
+#define RENDER_EVENT_SEEN 1 // A hibernating wallpaper got a frame callback
+#define RENDER_EVENT_PAUSE 2 // Pause reasons changed, see set_pause_reason()
+#define RENDER_EVENT_CACHE 3 // A first frame to write to the poster cache, struct poster_cache_job
+static struct poster_cache_job *poster_cache_jobs = NULL; // First frames read back once on screen, render thread only
+
+// Offscreen target mpv renders into once per frame when several outputs are drawn
+static struct {
+    GLuint fbo;
+    GLuint texture;
+    int width, height;
+
+    bool valid; // Holds the latest mpv frame
+    bool dirty; // Output sizes changed since the last allocation
+    bool swap_pending; // Frame not yet reported to mpv as presented
+    bool mipmapped; // Smaller levels hold the latest frame too, for outputs under half its size
+    GLsync fence; // Signals once the frame is drawn, output workers wait on it
+} shared_render = {0};
+
+
+enum blit_mode {
+    BLIT_FIT,
+    BLIT_FILL,
+    BLIT_STRETCH,
+};
 
 static uint SLIDESHOW_TIME = 0;
+static uint UNPAUSE_DELAY = 500; // ms
+#define UNPAUSE_DELAY_MAX 3600000 // One hour
 static bool SHOW_OUTPUTS = false;
 static int VERBOSE = 0;
+static int BLIT_MODE = BLIT_FIT;
+static bool HIBERNATE = false;
+static bool OUTPUT_THREADS = false;
+// Render size cap of -r, RENDER_SOURCE follows the video
+static uint RENDER_WIDTH = 0;
+static uint RENDER_HEIGHT = 0;
+static bool RENDER_SOURCE = false;
+static bool DYNAMIC_SCALE = false;
+enum buffer_format {
+    BUFFER_ARGB,
+    BUFFER_XRGB,
+    BUFFER_RGB565,
+    BUFFER_RGB10,
+};
+// Every format without alpha is opaque, see create_layer_surface()
+static const struct {
+    const char *name;
+    EGLint red, green, blue, alpha;
+} buffer_formats[] = {
+    [BUFFER_ARGB] = {"ARGB8888", 8, 8, 8, 8},
+    [BUFFER_XRGB] = {"XRGB8888", 8, 8, 8, 0},
+    [BUFFER_RGB565] = {"RGB565", 5, 6, 5, 0},
+    [BUFFER_RGB10] = {"XRGB2101010", 10, 10, 10, 0},
+};
+static int BUFFER_FORMAT = BUFFER_ARGB;
+#define OPAQUE_BUFFERS (buffer_formats[BUFFER_FORMAT].alpha == 0)
+#define DYNAMIC_SCALE_MIN 0.5
+#define DYNAMIC_SCALE_STEP 0.9 // Factor of one step down
+#define DYNAMIC_SCALE_SAMPLES 30 // Renders between steps
+static atomic_uint source_width = 0; // Display size of the current video, 0 until known
+static atomic_uint source_height = 0;
+
+// Last frames handed over by -P, see poster.h
+static struct poster poster = {.fd = -1};
+static atomic_bool awaiting_first_frame = false; // Posters or the last frame stay up until mpv has a new one
+
+// First frames of local files per output size, kept in $XDG_CACHE_HOME/mpvpaper
+#define POSTER_CACHE_MAX 16
+static char *poster_cache_dir;
+static uint64_t poster_cache_key; // 0 if video_path can't be cached
+
+// Render scheduling, see schedule_frame()
+#define FRAME_EARLY_USEC 4000 // Frames due sooner than this are drawn right away
+static uint64_t frame_seq = 0; // Bumped for every new mpv frame
+static struct {
+    uint64_t updates; // Render update callbacks
+    uint64_t frames; // Updates with a new frame
+    uint64_t skipped; // Updates with nothing new to draw
+    uint64_t deferred; // Frames held back until their target time
+    uint64_t renders;
+    uint64_t redundant; // Renders of a frame the output already showed
+    uint64_t hidden; // Renders skipped for outputs covered by windows
+} frame_stats = {0};
+
+// Window based pausing, see update_window_blocking()
+static bool unblock_pending = false;
+static struct {
+    uint64_t toggles; // Pauses/stops and resumes applied
+    uint64_t suppressed; // Resumes dropped because windows came back within UNPAUSE_DELAY
+} window_stats = {0};
+
+// Hidden wallpaper detection for auto-pause/stop, see check_visibility()
+#define HIDDEN_FRAMES 4 // Refreshes without a frame callback before a surface counts as hidden
+#define HIDDEN_MIN_USEC 50000
+#define HIDDEN_MAX_USEC 2000000
+static int64_t visibility_deadline = 0; // When visibility_timer_fd fires, 0 if disarmed
+static bool visibility_recheck = false; // Hidden while paused, checked again with mpv's next frame
+static struct {
+    uint64_t reactions;
+    int64_t latency_total; // us from the last unanswered commit to pausing/stopping
+    int64_t latency_max;
+} visibility_stats = {0};
+
+// Startup timeline shown with -v
+static struct {
+    struct timespec start;
+    bool configured;
+    bool first_frame;
+} startup = {0};
+
+static void log_startup(const char *milestone) {
+    if (!VERBOSE)
+        return;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double msec = (now.tv_sec - startup.start.tv_sec) * 1e3 + (now.tv_nsec - startup.start.tv_nsec) / 1e6;
+    cflp_info("Startup +%.1f ms: %s", msec, milestone);
+}
+
+static int64_t monotonic_usec() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+// Sync fence tracking wrapper to resolve libmpv memory/descriptor leaks by returning NULL
+// mpv only waits on and deletes its fences when it swaps a swapchain of its own, which libmpv never does
+// Every real fence would leak along with mpv's list of them, and mpv can't render ahead on them either
+static GLsync APIENTRY wrap_glFenceSync(GLenum condition, GLbitfield flags) {
+    (void)condition;
+    (void)flags;
+    return NULL;
+}
+
+// Tell mpv a frame was presented
+static void report_swap() {
+    if (mpv_glcontext)
+        mpv_render_context_report_swap(mpv_glcontext);
+}
 
+// Needs the context current
+static void free_render_context() {
+    mpv_render_context_free(mpv_glcontext);
+    mpv_glcontext = NULL;
+}
+
+struct render_call_args {
+    void (*fn)(void *);
+    void *data;
+};
+
+// Run fn on the render thread and wait for it, GL and EGL surfaces are only touched there
+static void render_call(void (*fn)(void *), void *data) {
+    if (!render_thread_running || pthread_equal(pthread_self(), render_thread)) {
+        fn(data);
+        return;
+    }
+
+    // Calls wait for each other, so the ring never holds more than one
+    struct render_call_args call = {fn, data};
+    ring_push(&render_calls, (struct ring_msg){0, &call});
+    if (write(render_call_fd, &(uint64_t){1}, sizeof(uint64_t)) < 0)
+        cflp_error("Failed to wake the render thread");
+
+    uint64_t done;
+    while (read(render_done_fd, &done, sizeof(done)) < 0 && errno == EINTR);
+}
+
+// False if the ring is full, the caller still owns data then
+static bool send_render_event(uint32_t type, void *data) {
+    // Events without data only repeat a state, one dropped from a full ring changes nothing
+    bool sent = ring_push(&render_events, (struct ring_msg){type, data});
+    if (write(render_event_fd, &(uint64_t){1}, sizeof(uint64_t)) < 0)
+        cflp_error("Failed to wake the main loop");
+    return sent;
+}
+
+// The last render call, the thread exits once it returns
+static void shutdown_render(void *data) {
+    if (mpv_glcontext) {
+        mpv_render_context_set_update_callback(mpv_glcontext, NULL, NULL);
+        free_render_context();
+    }
+    eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    render_thread_quit = true;
+}
+
+static struct wl_state *main_state; // Surfaces to tear down on exit
+static void destroy_display_output(struct display_output *output);
+static void stop_mpv_events();
+
+// Tear down in order: rendering, render context, mpv, surfaces, EGL
 static void exit_cleanup() {
+    int64_t start = monotonic_usec();
 
-    // Give mpv a chance to finish
-    halt_info.stop_render_loop = 1;
-    for (int trys=10; halt_info.stop_render_loop && trys > 0; trys--) {
-        usleep(10000);
+    // Nothing may draw from here on
+    if (render_thread_running) {
+        render_call(shutdown_render, NULL);
+        pthread_join(render_thread, NULL);
+        render_thread_running = false;
     }
-    // If render loop failed to stop it's self
-    if (halt_info.stop_render_loop && VERBOSE && pthread_self() != threads[0])
-        cflp_warning("Failed to quit mpv");
 
-    // Cancel all threads
-    for (uint i=0; threads[i] != 0; i++) {
-        if (pthread_self() != threads[i])
-            pthread_cancel(threads[i]);
+    // Only left if the render thread never started
+    if (mpv_glcontext) {
+        if (egl_display && !eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, egl_context))
+            cflp_warning("Failed to make context current %s", eglGetErrorString(eglGetError()));
+        free_render_context();
     }
+    int64_t render_done = monotonic_usec();
 
-    if (mpv_glcontext)
-        mpv_render_context_free(mpv_glcontext);
-    if (mpv)
+    if (mpv) {
+        stop_mpv_events();
         mpv_terminate_destroy(mpv);
+        mpv = NULL;
+    }
+    int64_t mpv_done = monotonic_usec();
 
+    if (main_state) {
+        struct display_output *output, *tmp_output;
+        wl_list_for_each_safe(output, tmp_output, &main_state->outputs, link) { destroy_display_output(output); }
+        wl_display_flush(main_state->display);
+    }
+    if (render_queue)
+        wl_event_queue_destroy(render_queue);
     if (egl_context)
         eglDestroyContext(egl_display, egl_context);
     if (egl_display)
         eglTerminate(egl_display);
+    int64_t surfaces_done = monotonic_usec();
+
+    if (VERBOSE)
+        cflp_info("Shutdown took %.1f ms: render %.1f ms, mpv %.1f ms, surfaces %.1f ms",
+                (surfaces_done - start) / 1e3, (render_done - start) / 1e3, (mpv_done - render_done) / 1e3,
+                (surfaces_done - mpv_done) / 1e3);
 
     if (wakeup_fd >= 0)
         close(wakeup_fd);
+    if (halt_fd >= 0)
+        close(halt_fd);
+    if (signal_fd >= 0)
+        close(signal_fd);
+    if (mpv_event_fd >= 0)
+        close(mpv_event_fd);
+    if (slideshow_fd >= 0)
+        close(slideshow_fd);
+    if (frame_timer_fd >= 0)
+        close(frame_timer_fd);
+    if (unblock_timer_fd >= 0)
+        close(unblock_timer_fd);
+    if (visibility_timer_fd >= 0)
+        close(visibility_timer_fd);
+    if (render_call_fd >= 0)
+        close(render_call_fd);
+    if (render_done_fd >= 0)
+        close(render_done_fd);
+    if (render_event_fd >= 0)
+        close(render_event_fd);
+    if (worker_done_fd >= 0)
+        close(worker_done_fd);
+    if (render_reactor.epoll_fd >= 0)
+        close(render_reactor.epoll_fd);
+    if (reactor.epoll_fd >= 0)
+        close(reactor.epoll_fd);
 }
 
 static void exit_mpvpaper(int reason) {
-    if (VERBOSE)
-        cflp_info("Exiting mpvpaper");
+    // Only the main thread can stop the render thread, fatal errors elsewhere exit right away
+    if (!pthread_equal(pthread_self(), main_thread))
+        exit(reason);
+
+    // The render thread is gone after this, so its stats are final
     exit_cleanup();
+    if (VERBOSE) {
+        cflp_info("Frames: %llu updates, %llu new, %llu skipped, %llu deferred, %llu renders (%llu redundant, "
+                "%llu hidden)",
+                (unsigned long long)frame_stats.updates, (unsigned long long)frame_stats.frames,
+                (unsigned long long)frame_stats.skipped, (unsigned long long)frame_stats.deferred,
+                (unsigned long long)frame_stats.renders, (unsigned long long)frame_stats.redundant,
+                (unsigned long long)frame_stats.hidden);
+        cflp_info("Pausing: %lu reason changes, %lu commands", atomic_load(&pause_state.changes),
+                atomic_load(&pause_state.commands));
+        cflp_info("Window pausing: %llu toggles, %llu suppressed",
+                (unsigned long long)window_stats.toggles, (unsigned long long)window_stats.suppressed);
+        if (visibility_stats.reactions)
+            cflp_info("Hidden wallpaper: %llu reactions, %.1f ms average, %.1f ms max",
+                    (unsigned long long)visibility_stats.reactions,
+                    visibility_stats.latency_total / 1e3 / visibility_stats.reactions,
+                    visibility_stats.latency_max / 1e3);
+        cflp_info("Exiting mpvpaper");
+    }
     exit(reason);
 }
 
-static void *exit_by_pthread(void *_) {
+static void handle_signal(struct reactor_source *source, uint32_t events) {
+    struct signalfd_siginfo info;
+    if (read(signal_fd, &info, sizeof(info)) != sizeof(info))
+        return;
+
+    if (VERBOSE)
+        cflp_info("Received %s", strsignal(info.ssi_signo));
     exit_mpvpaper(EXIT_SUCCESS);
-    pthread_exit(NULL);
 }
 
-static void handle_signal(int signum) {
-    (void)signum;
-    // Separate thread to avoid crash
-    pthread_t thread;
-    pthread_create(&thread, NULL, exit_by_pthread, NULL);
+const static struct wl_callback_listener wl_surface_frame_listener;
+
+// Windows are only tracked with auto-mode, fullscreen ones cover the top layer too
+static bool output_hidden(const struct display_output *output) {
+    return output->state->surface_layer != ZWLR_LAYER_SHELL_V1_LAYER_OVERLAY && output->blocking_windows > 0;
 }
 
-const static struct wl_callback_listener wl_surface_frame_listener;
+// Size mpv draws at, below the buffer size only when scaling without a viewport
+static void render_target_size(const struct display_output *output, int *width, int *height) {
+    *width = output->buffer_width;
+    *height = output->buffer_height;
+    if (!output->viewport && output->dynamic_scale < 1.0) {
+        *width = *width * output->dynamic_scale + 0.5;
+        *height = *height * output->dynamic_scale + 0.5;
+    }
+}
+
+// The shared target keeps every bit the output buffers can show
+static GLenum shared_render_format() {
+    return BUFFER_FORMAT == BUFFER_RGB10 ? GL_RGB10_A2 : GL_RGBA8;
+}
+
+static void resize_shared_render() {
+    shared_render.dirty = false;
+
+    // Size the target after the largest output so no output is upscaled
+    int width = 0, height = 0;
+    struct display_output *output;
+    wl_list_for_each(output, &render_outputs, render_link) {
+        int out_width, out_height;
+        render_target_size(output, &out_width, &out_height);
+        if ((int64_t)out_width * out_height > (int64_t)width * height) {
+            width = out_width;
+            height = out_height;
+        }
+    }
+
+    // mpv would letterbox the video into a target of another aspect and the blits would scale its bars along
+    // So the target takes the video's aspect, covering the largest output with FILL and fitting into it otherwise
+    uint32_t video_width = source_width, video_height = source_height;
+    if (video_width && video_height && width && height) {
+        bool wider = (int64_t)video_width * height > (int64_t)width * video_height;
+        if (wider == (BLIT_MODE == BLIT_FILL))
+            width = (int64_t)height * video_width / video_height;
+        else
+            height = (int64_t)width * video_height / video_width;
+
+        // Covering can get huge for extreme aspects
+        GLint max_size = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+        if (max_size > 0 && (width > max_size || height > max_size)) {
+            double shrink = (double)max_size / (width > height ? width : height);
+            width = width * shrink;
+            height = height * shrink;
+        }
+        if (width < 1) width = 1;
+        if (height < 1) height = 1;
+    }
+    if (width == shared_render.width && height == shared_render.height)
+        return;
+
+    if (!shared_render.fbo) {
+        glGenFramebuffers(1, &shared_render.fbo);
+        glGenTextures(1, &shared_render.texture);
+    }
+    glBindTexture(GL_TEXTURE_2D, shared_render.texture);
+    GLenum type = shared_render_format() == GL_RGB10_A2 ? GL_UNSIGNED_INT_2_10_10_10_REV : GL_UNSIGNED_BYTE;
+    glTexImage2D(GL_TEXTURE_2D, 0, shared_render_format(), width, height, 0, GL_RGBA, type, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, shared_render.fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, shared_render.texture, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        cflp_error("Shared render framebuffer is incomplete");
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    shared_render.width = width;
+    shared_render.height = height;
+    shared_render.valid = false;
+
+    if (VERBOSE)
+        cflp_info("Shared render target set to %ix%i", width, height);
+}
+
+static void render_shared_frame() {
+    // Output workers must be done reading the last frame
+    bool workers = false;
+    struct display_output *output;
+    wl_list_for_each(output, &render_outputs, render_link) {
+        if (!output->worker)
+            continue;
+        workers = true;
+        if (output->worker->blit_fence) {
+            glWaitSync(output->worker->blit_fence, 0, GL_TIMEOUT_IGNORED);
+            glDeleteSync(output->worker->blit_fence);
+            output->worker->blit_fence = NULL;
+        }
+    }
+
+    if (shared_render.dirty)
+        resize_shared_render();
 
-static void render(struct display_output *output) {
     mpv_render_param render_params[] = {
         {MPV_RENDER_PARAM_OPENGL_FBO, &(mpv_opengl_fbo) {
-            .fbo = 0,
-            .w = output->width * output->scale,
-            .h = output->height * output->scale,
+            .fbo = shared_render.fbo,
+            .w = shared_render.width,
+            .h = shared_render.height,
+            .internal_format = shared_render_format(),
         }},
-        // Flip rendering (needed due to flipped GL coordinate system).
+        // Keep the same orientation as the default framebuffer so blits are 1:1
         {MPV_RENDER_PARAM_FLIP_Y, &(int){1}},
-        // Do not wait for a fresh frame to render
         {MPV_RENDER_PARAM_BLOCK_FOR_TARGET_TIME, &(int){0}},
         {MPV_RENDER_PARAM_INVALID, NULL},
     };
 
+    int mpv_err = mpv_render_context_render(mpv_glcontext, render_params);
+    if (mpv_err < 0)
+        cflp_error("Failed to render shared frame with mpv, %s", mpv_error_string(mpv_err));
+
+    // One linear blit would skip most source pixels for outputs under half the size and alias
+    shared_render.mipmapped = false;
+    wl_list_for_each(output, &render_outputs, render_link) {
+        if (output->buffer_width * 2 <= shared_render.width && output->buffer_height * 2 <= shared_render.height) {
+            glBindTexture(GL_TEXTURE_2D, shared_render.texture);
+            glGenerateMipmap(GL_TEXTURE_2D);
+            glBindTexture(GL_TEXTURE_2D, 0);
+            shared_render.mipmapped = true;
+            break;
+        }
+    }
+
+    shared_render.valid = true;
+    shared_render.swap_pending = true;
+
+    // Output workers wait on the GPU, without fences only a finished frame is safe to hand over
+    if (workers) {
+        if (shared_render.fence)
+            glDeleteSync(shared_render.fence);
+        shared_render.fence = NULL;
+        if (GLAD_GL_VERSION_3_2) {
+            shared_render.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            glFlush();
+        } else {
+            glFinish();
+        }
+    }
+
+    if (VERBOSE == 2)
+        cflp_info("MPV rendered a shared frame at %ix%i", shared_render.width, shared_render.height);
+}
+
+static void blit_shared_frame(GLuint read_fbo, int dst_w, int dst_h) {
+    int src_w = shared_render.width, src_h = shared_render.height;
+    int src_x = 0, src_y = 0, dst_x = 0, dst_y = 0;
+    int blit_src_w = src_w, blit_src_h = src_h, blit_dst_w = dst_w, blit_dst_h = dst_h;
+
+    // Match aspect ratio unless stretching
+    int64_t src_aspect = (int64_t)src_w * dst_h;
+    int64_t dst_aspect = (int64_t)dst_w * src_h;
+    if (BLIT_MODE == BLIT_FILL && src_aspect != dst_aspect) {
+        // Crop the shared frame
+        if (src_aspect > dst_aspect) {
+            blit_src_w = (int64_t)src_h * dst_w / dst_h;
+            src_x = (src_w - blit_src_w) / 2;
+        } else {
+            blit_src_h = (int64_t)src_w * dst_h / dst_w;
+            src_y = (src_h - blit_src_h) / 2;
+        }
+    } else if (BLIT_MODE == BLIT_FIT && src_aspect != dst_aspect) {
+        // Letterbox the shared frame
+        if (src_aspect > dst_aspect) {
+            blit_dst_h = (int64_t)dst_w * src_h / src_w;
+            dst_y = (dst_h - blit_dst_h) / 2;
+        } else {
+            blit_dst_w = (int64_t)dst_h * src_w / src_h;
+            dst_x = (dst_w - blit_dst_w) / 2;
+        }
+    }
+
+    // Read from the smallest mipmap level still covering the output, the linear blit then shrinks by less than half
+    int level = 0;
+    if (shared_render.mipmapped) {
+        while ((blit_src_w >> (level + 1)) >= blit_dst_w && (blit_src_h >> (level + 1)) >= blit_dst_h)
+            level++;
+        src_x >>= level;
+        src_y >>= level;
+        blit_src_w >>= level;
+        blit_src_h >>= level;
+    }
+
+    bool same_size = blit_src_w == blit_dst_w && blit_src_h == blit_dst_h;
+
+    // mpv may leave scissoring enabled, which would clip clears and blits
+    glDisable(GL_SCISSOR_TEST);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, read_fbo);
+    if (level)
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, shared_render.texture, level);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    if (blit_dst_w != dst_w || blit_dst_h != dst_h)
+        glClear(GL_COLOR_BUFFER_BIT);
+    glBlitFramebuffer(src_x, src_y, src_x + blit_src_w, src_y + blit_src_h,
+            dst_x, dst_y, dst_x + blit_dst_w, dst_y + blit_dst_h,
+            GL_COLOR_BUFFER_BIT, same_size ? GL_NEAREST : GL_LINEAR);
+    // mpv renders into level 0 of the same framebuffer
+    if (level)
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, shared_render.texture, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+// How long an output may leave a frame callback unanswered while visible
+static int64_t hidden_timeout(const struct display_output *output) {
+    // Assume 60 Hz until the mode is known
+    int64_t period = output->refresh > 0 ? 1000000000LL / output->refresh : 16667;
+    // Some compositors throttle callbacks below the refresh rate
+    if (output->callback_latency > period)
+        period = output->callback_latency;
+
+    int64_t timeout = period * HIDDEN_FRAMES;
+    if (timeout < HIDDEN_MIN_USEC)
+        return HIDDEN_MIN_USEC;
+    if (timeout > HIDDEN_MAX_USEC)
+        return HIDDEN_MAX_USEC;
+    return timeout;
+}
+
+static void set_visibility_timer(int64_t deadline) {
+    visibility_deadline = deadline;
+    struct itimerspec target = {
+        .it_value = {.tv_sec = deadline / 1000000, .tv_nsec = (deadline % 1000000) * 1000},
+    };
+    if (timerfd_settime(visibility_timer_fd, TFD_TIMER_ABSTIME, &target, NULL) == -1)
+        cflp_error("Failed to set visibility timer");
+}
+
+// Make sure the timer fires by the time this output's callback is overdue
+static void watch_frame_callback(struct display_output *output) {
+    output->callback_requested = monotonic_usec();
+    output->callback_overdue = false;
+    if (!halt_info.auto_pause && !halt_info.auto_stop)
+        return;
+
+    // Earlier deadlines reschedule the timer once it fires
+    int64_t deadline = output->callback_requested + hidden_timeout(output);
+    if (!visibility_deadline || deadline < visibility_deadline)
+        set_visibility_timer(deadline);
+}
+
+// GPU time of renders through timestamps, mpv's own timer queries would clash with GL_TIME_ELAPSED
+static void begin_render_timer(struct display_output *output) {
+    if (!DYNAMIC_SCALE || !GLAD_GL_VERSION_3_3)
+        return;
+    if (!output->timer_queries[0][0])
+        glGenQueries(4, &output->timer_queries[0][0]);
+
+    // Results of this pair are from two renders ago, only read when they won't stall
+    int index = output->timer_index;
+    if (output->timer_pending[index]) {
+        GLint available = 0;
+        glGetQueryObjectiv(output->timer_queries[index][1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available) {
+            GLuint64 start, end;
+            glGetQueryObjectui64v(output->timer_queries[index][0], GL_QUERY_RESULT, &start);
+            glGetQueryObjectui64v(output->timer_queries[index][1], GL_QUERY_RESULT, &end);
+            output->gpu_time = (end - start) / 1000;
+        }
+    }
+    glQueryCounter(output->timer_queries[index][0], GL_TIMESTAMP);
+}
+
+static void end_render_timer(struct display_output *output) {
+    if (!DYNAMIC_SCALE || !GLAD_GL_VERSION_3_3)
+        return;
+    int index = output->timer_index;
+    glQueryCounter(output->timer_queries[index][1], GL_TIMESTAMP);
+    output->timer_pending[index] = true;
+    output->timer_index = !index;
+}
+
+static void update_dynamic_scale(struct display_output *output, int64_t cpu_time);
+
+static bool workers_busy() {
+    struct display_output *output;
+    wl_list_for_each(output, &render_outputs, render_link) {
+        if (output->worker && atomic_load(&output->worker->busy))
+            return true;
+    }
+    return false;
+}
+
+static void queue_worker_job(struct output_worker *worker, uint32_t type) {
+    if (!ring_push(&worker->jobs, (struct ring_msg){type, NULL}))
+        cflp_error("Output worker of %s is not keeping up", worker->output->name);
+    if (write(worker->wake_fd, &(uint64_t){1}, sizeof(uint64_t)) < 0)
+        cflp_error("Failed to wake output worker of %s", worker->output->name);
+}
+
+static void present_worker_frame(struct output_worker *worker) {
+    if (worker->frame_fence)
+        glWaitSync(worker->frame_fence, 0, GL_TIMEOUT_IGNORED);
+
+    // Framebuffers are not shared between contexts, only the texture is
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, worker->read_fbo);
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, shared_render.texture, 0);
+    glViewport(0, 0, worker->width, worker->height);
+    blit_shared_frame(worker->read_fbo, worker->width, worker->height);
+
+    if (worker->blit_fence)
+        glDeleteSync(worker->blit_fence);
+    worker->blit_fence = NULL;
+    if (GLAD_GL_VERSION_3_2)
+        worker->blit_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    else
+        glFinish();
+
+    if (!eglSwapBuffers(egl_display, worker->surface))
+        cflp_error("Failed to swap egl buffers %s", eglGetErrorString(eglGetError()));
+    worker->presented = true;
+
+    atomic_store(&worker->busy, false);
+    if (write(worker_done_fd, &(uint64_t){1}, sizeof(uint64_t)) < 0)
+        cflp_error("Failed to wake the render thread");
+}
+
+static void *output_worker_main(void *data) {
+    struct output_worker *worker = data;
+
+    // Bound once, no output ever has to switch the context to its surface again
+    if (!eglMakeCurrent(egl_display, worker->surface, worker->surface, worker->context))
+        cflp_error("Failed to make output surface current %s", eglGetErrorString(eglGetError()));
+    eglSwapInterval(egl_display, 0);
+    glDrawBuffer(GL_BACK);
+    glClearColor(0.0f, 0.0f, 0.0f, OPAQUE_BUFFERS ? 1.0f : 0.0f);
+    glGenFramebuffers(1, &worker->read_fbo);
+
+    bool quit = false;
+    while (!quit) {
+        uint64_t tmp;
+        if (read(worker->wake_fd, &tmp, sizeof(tmp)) < 0 && errno != EINTR)
+            break;
+
+        struct ring_msg msg;
+        while (!quit && ring_pop(&worker->jobs, &msg)) {
+            if (msg.type == WORKER_PRESENT)
+                present_worker_frame(worker);
+            else if (msg.type == WORKER_RESIZE)
+                wl_egl_window_resize(worker->output->egl_window, worker->resize_width, worker->resize_height, 0, 0);
+            else if (msg.type == WORKER_QUIT)
+                quit = true;
+        }
+    }
+
+    glDeleteFramebuffers(1, &worker->read_fbo);
+    if (worker->blit_fence)
+        glDeleteSync(worker->blit_fence);
+    eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    return NULL;
+}
+
+static void free_output_worker(struct output_worker *worker) {
+    if (worker->context)
+        eglDestroyContext(egl_display, worker->context);
+    if (worker->wake_fd >= 0)
+        close(worker->wake_fd);
+    ring_finish(&worker->jobs);
+    free(worker);
+}
+
+static struct output_worker *start_output_worker(struct display_output *output) {
+    struct output_worker *worker = calloc(1, sizeof(struct output_worker));
+    if (!worker)
+        return NULL;
+    worker->output = output;
+    worker->surface = output->egl_surface;
+
+    const EGLint ctx_attrib[] = {
+        EGL_CONTEXT_MAJOR_VERSION, gl_version[0],
+        EGL_CONTEXT_MINOR_VERSION, gl_version[1],
+        EGL_NONE
+    };
+    worker->context = eglCreateContext(egl_display, egl_config, egl_context, ctx_attrib);
+    worker->wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (!worker->context || worker->wake_fd == -1 || !ring_init(&worker->jobs, 8) ||
+            pthread_create(&worker->thread, NULL, output_worker_main, worker) != 0) {
+        free_output_worker(worker);
+        return NULL;
+    }
+
+    if (VERBOSE)
+        cflp_info("%s is drawn on its own thread", output->name);
+    return worker;
+}
+
+static void stop_output_worker(struct output_worker *worker) {
+    queue_worker_job(worker, WORKER_QUIT);
+    pthread_join(worker->thread, NULL);
+    free_output_worker(worker);
+}
+
+// Hand the shared frame to the output's worker, which blits and swaps in parallel to the others
+static void render_on_worker(struct display_output *output) {
+    struct output_worker *worker = output->worker;
+
+    // Drawn again once the worker or every worker is done with the last frame
+    if (atomic_load(&worker->busy) ||
+            ((!shared_render.valid || shared_render.dirty) && workers_busy())) {
+        output->redraw_needed = true;
+        return;
+    }
+
+    if (!shared_render.valid || shared_render.dirty) {
+        if (!eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, egl_context))
+            cflp_error("Failed to make context current %s", eglGetErrorString(eglGetError()));
+        // Blits run in parallel on the workers, only the mpv pass counts
+        int64_t render_start = monotonic_usec();
+        begin_render_timer(output);
+        render_shared_frame();
+        end_render_timer(output);
+        update_dynamic_scale(output, monotonic_usec() - render_start);
+    }
+
+    output->frame_callback = wl_surface_frame(output->render_surface);
+    wl_callback_add_listener(output->frame_callback, &wl_surface_frame_listener, output);
+    watch_frame_callback(output);
+    output->redraw_needed = false;
+
+    worker->frame_fence = shared_render.fence;
+    worker->width = output->buffer_width;
+    worker->height = output->buffer_height;
+    atomic_store(&worker->busy, true);
+    queue_worker_job(worker, WORKER_PRESENT);
+
+    if (shared_render.swap_pending) {
+        report_swap();
+        shared_render.swap_pending = false;
+    }
+}
+
+static void render(struct display_output *output) {
+    // Nothing to render until mpv is revived or has a first frame
+    if (halt_info.hibernating || awaiting_first_frame || !mpv_glcontext)
+        return;
+
+    // Drawn once it is uncovered
+    if (output_hidden(output)) {
+        frame_stats.hidden++;
+        output->redraw_needed = true;
+        return;
+    }
+
+    frame_stats.renders++;
+    if (output->rendered_seq == frame_seq)
+        frame_stats.redundant++;
+    output->rendered_seq = frame_seq;
+
+    if (output->worker) {
+        render_on_worker(output);
+        return;
+    }
+
     if (!eglMakeCurrent(egl_display, output->egl_surface, output->egl_surface, egl_context))
         cflp_error("Failed to make output surface current %s", eglGetErrorString(eglGetError()));
 
-    glViewport(0, 0, output->width * output->scale, output->height * output->scale);
+    glViewport(0, 0, output->buffer_width, output->buffer_height);
 
-    // Render frame
-    int mpv_err = mpv_render_context_render(mpv_glcontext, render_params);
-    if (mpv_err < 0)
-        cflp_error("Failed to render frame with mpv, %s", mpv_error_string(mpv_err));
+    int64_t render_start = monotonic_usec();
+    begin_render_timer(output);
+
+    // Without a viewport a scaled down frame is upscaled by the blit
+    bool shared = wl_list_length(&render_outputs) > 1 || (!output->viewport && output->dynamic_scale < 1.0);
+    if (shared) {
+        // Only the first output to draw a new frame pays for the mpv render pass
+        if (!shared_render.valid || shared_render.dirty) {
+            // Output workers may still read the last one
+            if (workers_busy()) {
+                end_render_timer(output);
+                output->redraw_needed = true;
+                return;
+            }
+            render_shared_frame();
+        }
+        blit_shared_frame(shared_render.fbo, output->buffer_width, output->buffer_height);
+    } else {
+        mpv_render_param render_params[] = {
+            {MPV_RENDER_PARAM_OPENGL_FBO, &(mpv_opengl_fbo) {
+                .fbo = 0,
+                .w = output->buffer_width,
+                .h = output->buffer_height,
+            }},
+            // Flip rendering (needed due to flipped GL coordinate system).
+            {MPV_RENDER_PARAM_FLIP_Y, &(int){1}},
+            // Do not wait for a fresh frame to render
+            {MPV_RENDER_PARAM_BLOCK_FOR_TARGET_TIME, &(int){0}},
+            {MPV_RENDER_PARAM_INVALID, NULL},
+        };
+
+        // Render frame
+        int mpv_err = mpv_render_context_render(mpv_glcontext, render_params);
+        if (mpv_err < 0)
+            cflp_error("Failed to render frame with mpv, %s", mpv_error_string(mpv_err));
+    }
+    end_render_timer(output);
 
-    // Callback new frame
-    output->frame_callback = wl_surface_frame(output->surface);
+    // Callback new frame, dispatched on the render thread
+    output->frame_callback = wl_surface_frame(output->render_surface);
     wl_callback_add_listener(output->frame_callback, &wl_surface_frame_listener, output);
+    watch_frame_callback(output);
     output->redraw_needed = false;
 
     // Display frame
-    if (!eglSwapBuffers(egl_display, output->egl_surface))
+    if (!eglSwapBuffers(egl_display, output->egl_surface)) {
         cflp_error("Failed to swap egl buffers %s", eglGetErrorString(eglGetError()));
-    else {
+        return;
+    }
+    if (!shared || shared_render.swap_pending) {
         // Inform libmpv that the buffer has been presented so it can release any
         // associated GL fence objects and resources
-        if (mpv_glcontext)
-            mpv_render_context_report_swap(mpv_glcontext);
+        report_swap();
+        shared_render.swap_pending = false;
+    }
+    // The poster got replaced by the EGL buffer
+    if (output->poster_buffer) {
+        wl_buffer_destroy(output->poster_buffer);
+        output->poster_buffer = NULL;
     }
+
+    update_dynamic_scale(output, monotonic_usec() - render_start);
+}
+
+static void wake_main_loop() {
+    if (write(halt_fd, &(uint64_t){1}, sizeof(uint64_t)) < 0)
+        cflp_error("Failed to wake the main loop");
+}
+
+// Stopping and reviving touch GL and Wayland state, so they only run on the main loop
+static void request_stop() {
+    halt_info.stop_requested = 1;
+    wake_main_loop();
+}
+static void request_revive() {
+    halt_info.revive_requested = 1;
+    wake_main_loop();
+}
+
+static uint32_t running_watch_lists();
+static void set_pause_reason(uint32_t reason, bool set, const char *why);
+static void update_video_size(void *data);
+static void save_cached_posters();
+static void handle_watched_exit(struct reactor_source *source, uint32_t events);
+
+// Anything keeping a stopped mpvpaper from coming back
+static bool is_blocked() {
+    return halt_info.window_blocking || (running_watch_lists() & WATCH_STOPLIST);
 }
 
 static void frame_handle_done(void *data, struct wl_callback *callback, uint32_t frame_time) {
-    (void)frame_time;
     struct display_output *output = data;
     wl_callback_destroy(callback);
 
     // Display is ready for new frame
     output->frame_callback = NULL;
 
-    // Reset deadman switch timer
-    pthread_mutex_lock(&halt_mutex);
-    halt_info.frame_ready = 1;
-    pthread_mutex_unlock(&halt_mutex);
+    // Smooth the callback interval, gaps from paused or held frames are ignored
+    uint32_t interval = frame_time - output->last_frame_time;
+    if (output->last_frame_time && interval > 0 && interval < 1000)
+        output->frame_interval = output->frame_interval ? (output->frame_interval * 7 + interval) / 8 : interval;
+    output->last_frame_time = frame_time;
+
+    // Late callbacks only tell that the surface was hidden for a while
+    if (output->callback_requested && !output->callback_overdue) {
+        int64_t latency = monotonic_usec() - output->callback_requested;
+        output->callback_latency = output->callback_latency ? (output->callback_latency * 7 + latency) / 8 : latency;
+    }
+    output->callback_requested = 0;
+    output->callback_overdue = false;
+
+    // Seen again
+    set_pause_reason(PAUSE_AUTO, false, "Frame Callback");
+
+    // The first frame is on screen, reading it back can no longer delay it
+    if (poster_cache_jobs)
+        save_cached_posters();
+
+    // The wallpaper is visible again, reviving is up to the main thread
+    if (halt_info.hibernating) {
+        send_render_event(RENDER_EVENT_SEEN, NULL);
+        return;
+    }
 
     // Render next frame
     if (output->redraw_needed) {
@@ -223,255 +1129,383 @@ const static struct wl_callback_listener wl_surface_frame_listener = {
     .done = frame_handle_done,
 };
 
-static void stop_mpvpaper() {
-
-    // Save video position to arg -Z
-    const char *time_pos = mpv_get_property_string(mpv, "time-pos");
-    const char *playlist_pos = mpv_get_property_string(mpv, "playlist-pos");
-
-    char save_info[30];
-    snprintf(save_info, sizeof(save_info), "%s %s", time_pos, playlist_pos);
-
-    char **new_argv = calloc(halt_info.argc + 3, sizeof(char *)); // Plus 3 for adding in -Z
-    if (!new_argv) {
-        cflp_error("Failed to allocate new argv");
-        exit(EXIT_FAILURE);
-    }
+static int compare_next_callback(const void *a, const void *b) {
+    const struct display_output *output_a = *(struct display_output *const *)a;
+    const struct display_output *output_b = *(struct display_output *const *)b;
+    uint32_t next_a = output_a->last_frame_time + output_a->frame_interval;
+    uint32_t next_b = output_b->last_frame_time + output_b->frame_interval;
+    return (int32_t)(next_a - next_b);
+}
 
-    uint i = 0;
-    for (i=0; i < halt_info.argc; i++) {
-        new_argv[i] = strdup(halt_info.argv_copy[i]);
+// Hand the current frame to every output
+static void render_new_frame() {
+    int count = wl_list_length(&render_outputs);
+    if (count == 0)
+        return;
+
+    // Outputs expecting their next frame callback soonest get the frame first
+    struct display_output *outputs[count];
+    int i = 0;
+    struct display_output *output;
+    wl_list_for_each(output, &render_outputs, render_link) {
+        outputs[i++] = output;
     }
-    new_argv[i] = strdup("-Z");
-    new_argv[i+1] = strdup(save_info);
-    new_argv[i+2] = NULL;
-
-    // Get the "real" cwd
-    char exe_dir[1024];
-    int cut_point = readlink("/proc/self/exe", exe_dir, sizeof(exe_dir));
-    for (uint i=cut_point; i > 1; i--) {
-        if (exe_dir[i] == '/') {
-            exe_dir[i+1] = '\0';
-            break;
+    qsort(outputs, count, sizeof(outputs[0]), compare_next_callback);
+
+    for (i=0; i < count; i++) {
+        output = outputs[i];
+        // Redraw immediately if not waiting for frame callback
+        if (output->frame_callback == NULL) {
+            if (VERBOSE == 2)
+                cflp_info("MPV is ready to render the next frame for %s", output->name);
+            render(output);
+        } else {
+            output->redraw_needed = true;
         }
     }
+}
 
-    exit_cleanup();
+// Draw a new mpv frame now or at its target time
+static void schedule_frame() {
+    mpv_render_frame_info info = {0};
+    if (mpv_render_context_get_info(mpv_glcontext,
+            (mpv_render_param){MPV_RENDER_PARAM_NEXT_FRAME_INFO, &info}) >= 0) {
+        if (!(info.flags & MPV_RENDER_FRAME_INFO_PRESENT)) {
+            frame_stats.skipped++;
+            return;
+        }
 
-    // Start holder script
-    execv(strcat(exe_dir, "mpvpaper-holder"), new_argv);
+        // Redraws have no target time, only hold back frames that would show up a refresh early
+        int64_t wait = info.target_time ? info.target_time - mpv_get_time_us(mpv) : 0;
+        if (!(info.flags & MPV_RENDER_FRAME_INFO_REDRAW) && wait > FRAME_EARLY_USEC && wait < 1000000) {
+            struct itimerspec target = {
+                .it_value = {.tv_sec = wait / 1000000, .tv_nsec = (wait % 1000000) * 1000},
+            };
+            if (timerfd_settime(frame_timer_fd, 0, &target, NULL) == 0) {
+                frame_stats.deferred++;
+                if (VERBOSE == 2)
+                    cflp_info("Holding frame back for %lli us", (long long)wait);
+                return;
+            }
+        }
+    }
 
-    cflp_error("Failed to stop mpvpaper");
-    exit(EXIT_FAILURE);
+    render_new_frame();
 }
 
-// Allow pthread_cancel while sleeping
-static void pthread_sleep(uint time) {
-    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-    sleep(time);
-    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+// The only place mpv is told to pause or resume, only ever run on the main thread
+// Commands from one thread reach mpv in order, so the last one always matches the latest reasons
+static void apply_pause_state() {
+    // A revived mpv gets the remaining reasons applied, mpv only changes while hibernating
+    bool pause;
+    if (halt_info.hibernating || !mpv || !pause_next_command(&pause_state, &pause))
+        return;
+
+    mpv_command_async(mpv, MPV_REPLY_PAUSE, (const char *[]){
+        "set",
+        "pause",
+        pause ? "yes" : "no",
+        NULL
+    });
 }
-static void pthread_usleep(uint time) {
-    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-    usleep(time);
-    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-}
-
-// Update pause flags and mpv state safely
-static void update_mpv_pause_state(bool *pause_flag, bool new_flag_state, const char *reason) {
-    pthread_mutex_lock(&halt_mutex);
 
-    *pause_flag = new_flag_state;
-
-    bool call_pause = (
-        halt_info.list_paused ||
-        halt_info.auto_paused ||
-        halt_info.user_paused ||
-        halt_info.full_paused);
-
-    // Only command MPV if the aggregate state changes
-    if (call_pause != halt_info.mpv_paused) {
-        halt_info.mpv_paused = call_pause;
+static void set_pause_reason(uint32_t reason, bool set, const char *why) {
+    if (!pause_swap_reason(&pause_state, reason, set))
+        return;
+
+    if (why && VERBOSE)
+        cflp_info("Pause %s by: %s", set ? "triggered" : "cleared", why);
+    // Other threads hand applying to the main loop
+    if (pthread_equal(pthread_self(), main_thread))
+        apply_pause_state();
+    else
+        send_render_event(RENDER_EVENT_PAUSE, NULL);
+}
 
-        if (new_flag_state && reason && VERBOSE)
-            cflp_info("Pause triggered by: %s", reason);
-        else if (reason && VERBOSE)
-            cflp_info("Pause cleared by: %s", reason);
+// mpv is the truth, no command is sent back so the user is never overruled
+static void report_mpv_pause() {
+    int paused = 0;
+    mpv_get_property(mpv, "pause", MPV_FORMAT_FLAG, &paused);
+    pause_report(&pause_state, paused);
+}
 
-        mpv_command_async(mpv, 0, (const char *[]){
-            "set",
-            "pause",
-            call_pause ? "yes" : "no",
-            NULL
-        });
-    }
+static uint32_t running_watch_lists() {
+    uint32_t lists = 0;
+    for (size_t i=0; i < watch_state.procs.count; i++)
+        lists |= watch_state.procs.procs[i].lists;
+    return lists;
+}
 
-    pthread_mutex_unlock(&halt_mutex);
+static void remove_watched_proc(size_t index) {
+    reactor_remove(&reactor, watch_state.procs.procs[index].data);
+    procwatch_untrack(&watch_state.procs, index);
 }
 
-static char *check_watch_list(char **list) {
+static void update_watch_lists() {
+    const char *pause_app = NULL;
+    const char *stop_app = NULL;
+    for (size_t i=0; i < watch_state.procs.count; i++) {
+        if (watch_state.procs.procs[i].lists & WATCH_STOPLIST)
+            stop_app = watch_state.procs.procs[i].name;
+        if (watch_state.procs.procs[i].lists & WATCH_PAUSELIST)
+            pause_app = watch_state.procs.procs[i].name;
+    }
 
-    char pid_name[512] = {0};
+    // Stopping always wins out
+    if (stop_app && !halt_info.hibernating) {
+        if (VERBOSE)
+            cflp_info("Stopping for %s", stop_app);
+        request_stop();
+    } else if (!stop_app && halt_info.hibernating) {
+        request_revive();
+    }
 
-    for (uint i=0; list[i] != NULL; i++) {
-        snprintf(pid_name, sizeof(pid_name), "pidof %s > /dev/null", list[i]);
+    set_pause_reason(PAUSE_LIST, pause_app != NULL, pause_app ? pause_app : "Blocking Apps");
 
-        // Stop if program is open
-        if (!system(pid_name))
-            return list[i];
+    // Only keep scanning while a list could still match something new
+    bool need_scan = procwatch_has_unwatched(&watch_state.procs) ||
+        (halt_info.pauselist && !pause_app) ||
+        (halt_info.stoplist && !stop_app);
+    struct itimerspec period = {0};
+    if (need_scan) {
+        period.it_interval.tv_sec = 1;
+        period.it_value.tv_sec = 1;
     }
-    return NULL;
+    if (timerfd_settime(watch_state.timer_fd, 0, &period, NULL) == -1)
+        cflp_error("Failed to set watch list timer");
 }
 
-static void *monitor_pauselist(void *_) {
-    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-    bool list_paused = 0;
+static void scan_watch_lists() {
+    // Processes without a pidfd have no reactor source to remove
+    procwatch_untrack_unwatched(&watch_state.procs);
 
-    while (halt_info.pauselist) {
+    // One walk of /proc covers both lists
+    procwatch_scan(&watch_lists);
+    if (VERBOSE == 2)
+        cflp_info("Scanned %u processes for watch lists in %ld us",
+                watch_lists.procs_scanned, watch_lists.scan_usec);
 
-        char *app = check_watch_list(halt_info.pauselist);
-        if (app && !list_paused && !halt_info.list_paused && !halt_info.mpv_paused) {
-            update_mpv_pause_state(&halt_info.list_paused, true, app);
-            list_paused = 1;
-        } else if (!app && list_paused) {
-            update_mpv_pause_state(&halt_info.list_paused, false, "Blocking Apps");
-            list_paused = 0;
+    size_t old_count = watch_state.procs.count;
+    if (!procwatch_track(&watch_state.procs, &watch_lists)) {
+        cflp_error("Failed to reallocate watched processes");
+        exit_mpvpaper(EXIT_FAILURE);
+    }
+    for (size_t i = old_count; i < watch_state.procs.count; i++) {
+        struct procwatch_proc *proc = &watch_state.procs.procs[i];
+        if (proc->pidfd >= 0) {
+            proc->data = reactor_add(&reactor, proc->pidfd, EPOLLIN, handle_watched_exit, NULL);
+            if (!proc->data) {
+                cflp_error("Failed to watch %s (%d)", proc->name, proc->pid);
+                close(proc->pidfd);
+                proc->pidfd = -1;
+            }
         }
-
-
-        pthread_sleep(1);
+        if (VERBOSE == 2)
+            cflp_info("Watching %s (%d) until it exits", proc->name, proc->pid);
     }
-    pthread_exit(NULL);
-}
 
-static void *monitor_stoplist(void *_) {
-    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    update_watch_lists();
+}
 
-    while (halt_info.stoplist) {
+// A blocking app exited, react right away
+static void handle_watched_exit(struct reactor_source *source, uint32_t events) {
+    uint32_t old_lists = running_watch_lists();
 
-        char *app = check_watch_list(halt_info.stoplist);
-        if (app) {
-            if (VERBOSE)
-                cflp_info("Stopping for %s", app);
-            stop_mpvpaper();
+    for (size_t i=0; i < watch_state.procs.count; i++) {
+        if (watch_state.procs.procs[i].data == source) {
+            if (VERBOSE == 2)
+                cflp_info("%s (%d) exited", watch_state.procs.procs[i].name, watch_state.procs.procs[i].pid);
+            remove_watched_proc(i);
+            break;
         }
-
-        pthread_sleep(1);
     }
-    pthread_exit(NULL);
+
+    // Rescan to catch other instances started since the last scan
+    if (running_watch_lists() != old_lists)
+        scan_watch_lists();
 }
 
-static void *handle_auto_pause(void *_) {
-    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+// Pause/stop once no output answers its frame callback within a few refreshes
+static void check_visibility() {
+    visibility_deadline = 0;
+    int64_t now = monotonic_usec();
+    int64_t next_deadline = 0;
+    int64_t hidden_since = 0;
+    bool visible = false;
+
+    struct display_output *output;
+    wl_list_for_each(output, &render_outputs, render_link) {
+        if (output->callback_requested && !output->callback_overdue) {
+            int64_t deadline = output->callback_requested + hidden_timeout(output);
+            if (now >= deadline) {
+                output->callback_overdue = true;
+                if (VERBOSE == 2)
+                    cflp_info("%s has not answered a frame callback in %lli us", output->name,
+                            (long long)(now - output->callback_requested));
+            } else if (!next_deadline || deadline < next_deadline) {
+                next_deadline = deadline;
+            }
+        }
 
-    while (halt_info.auto_pause) {
+        if (output->callback_overdue) {
+            if (output->callback_requested > hidden_since)
+                hidden_since = output->callback_requested;
+        } else if (!output_hidden(output)) {
+            visible = true;
+        }
+    }
 
-        // Set deadman switch timer
-        pthread_mutex_lock(&halt_mutex);
-        halt_info.frame_ready = 0;
-        pthread_mutex_unlock(&halt_mutex);
+    // Also gone while hibernating or once the render thread shuts down
+    if (visible || !hidden_since || !mpv_glcontext) {
+        if (next_deadline)
+            set_visibility_timer(next_deadline);
+        return;
+    }
 
-        pthread_sleep(2);
+    // Paused surfaces stop asking for callbacks too, but resuming brings a new frame, so no timer is needed
+    if (atomic_load(&pause_state.applied) || awaiting_first_frame) {
+        visibility_recheck = true;
+        return;
+    }
 
-        if (!halt_info.frame_ready && !halt_info.auto_paused && !halt_info.mpv_paused) {
-            update_mpv_pause_state(&halt_info.auto_paused, true, "Frame Callback");
+    int64_t latency = now - hidden_since;
+    visibility_stats.reactions++;
+    visibility_stats.latency_total += latency;
+    if (latency > visibility_stats.latency_max)
+        visibility_stats.latency_max = latency;
 
-            while (!halt_info.frame_ready) {
-                pthread_usleep(10000);
-            }
-            if (halt_info.auto_paused)
-                update_mpv_pause_state(&halt_info.auto_paused, false, "Frame Callback");
-        }
+    if (halt_info.auto_pause) {
+        if (VERBOSE)
+            cflp_info("Pausing %.1f ms after mpvpaper was hidden", latency / 1e3);
+        set_pause_reason(PAUSE_AUTO, true, "Frame Callback");
+    } else if (halt_info.auto_stop) {
+        if (VERBOSE)
+            cflp_info("Stopping %.1f ms after mpvpaper was hidden", latency / 1e3);
+        request_stop();
     }
-    pthread_exit(NULL);
 }
 
-static void *handle_auto_stop(void *_) {
-    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-
-    while (halt_info.auto_stop) {
-
-        // Set deadman switch timer
-        pthread_mutex_lock(&halt_mutex);
-        halt_info.frame_ready = 0;
-        pthread_mutex_unlock(&halt_mutex);
-
-        pthread_sleep(2);
+static void mpv_wakeup_callback(void *_) {
+    uint64_t inc = 1;
+    if (write(mpv_event_fd, &inc, sizeof(inc)) < 0 && errno != EAGAIN)
+        cflp_error("Failed to write to mpv event eventfd");
+}
 
-        // While annoying, pausing also causes the frame to not callback and must be ignored
-        if (!halt_info.frame_ready && !halt_info.mpv_paused) {
-            if (VERBOSE)
-                cflp_info("Stopping because mpvpaper is hidden");
-            stop_mpvpaper();
-        }
+// Empty an eventfd or timerfd
+static void drain_fd(int fd) {
+    uint64_t tmp;
+    if (read(fd, &tmp, sizeof(tmp)) == -1 && errno != EAGAIN) {
+        cflp_error("Failed to read fd %d, %s", fd, strerror(errno));
+        exit_mpvpaper(EXIT_FAILURE);
     }
-    pthread_exit(NULL);
 }
 
-static void *handle_mpv_events(void *_) {
-    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-    int mpv_paused = 0;
-    time_t start_time = time(NULL);
+#define MPV_OBSERVE_PAUSE 1
+static bool mpv_file_loaded = false;
 
-    const int MPV_OBSERVE_PAUSE = 1;
+// Called for every new mpv handle
+static void start_mpv_events() {
+    mpv_file_loaded = false;
     mpv_observe_property(mpv, MPV_OBSERVE_PAUSE, "pause", MPV_FORMAT_FLAG);
+    mpv_set_wakeup_callback(mpv, mpv_wakeup_callback, NULL);
+}
 
-    while (!halt_info.stop_render_loop) {
-        if (SLIDESHOW_TIME) {
-            if ((time(NULL) - start_time) >= SLIDESHOW_TIME) {
-                mpv_command_async(mpv, 0, (const char *[]){"playlist-next", NULL});
-                start_time = time(NULL);
-            }
-        }
+static void stop_mpv_events() {
+    mpv_set_wakeup_callback(mpv, NULL, NULL);
+    mpv_unobserve_property(mpv, MPV_OBSERVE_PAUSE);
+}
 
-        mpv_event *event = mpv_wait_event(mpv, 0);
+static void handle_mpv_events(struct reactor_source *source, uint32_t events) {
+    drain_fd(mpv_event_fd);
+    // A wakeup may still be queued from before hibernating
+    if (!mpv)
+        return;
+
+    // Drain every queued event, the wakeup callback only fires for new ones
+    mpv_event *event;
+    while ((event = mpv_wait_event(mpv, 0))->event_id != MPV_EVENT_NONE) {
 
         if (event->event_id == MPV_EVENT_SHUTDOWN) {
             exit_mpvpaper(EXIT_SUCCESS);
-        } else if (event->event_id == MPV_EVENT_PROPERTY_CHANGE) {
-            if (event->reply_userdata == MPV_OBSERVE_PAUSE) {
-                mpv_get_property(mpv, "pause", MPV_FORMAT_FLAG, &mpv_paused);
-                if (mpv_paused) {
-                    // User paused
-                    if (!halt_info.list_paused && !halt_info.auto_paused && !halt_info.full_paused)
-                        update_mpv_pause_state(&halt_info.user_paused, true, NULL);
-                } else { // Clear paused checks if not paused
-                    update_mpv_pause_state(&halt_info.user_paused, false, NULL);
-                }
+        } else if (event->event_id == MPV_EVENT_COMMAND_REPLY && event->reply_userdata == MPV_REPLY_LOAD) {
+            if (event->error < 0) {
+                cflp_error("Failed to load file, %s", mpv_error_string(event->error));
+                exit_mpvpaper(EXIT_FAILURE);
+            }
+        } else if (event->event_id == MPV_EVENT_COMMAND_REPLY && event->reply_userdata == MPV_REPLY_PAUSE) {
+            // Changes seen while commands were in flight were ignored, mpv has caught up with all of them now
+            if (pause_command_done(&pause_state))
+                report_mpv_pause();
+        } else if (event->event_id == MPV_EVENT_VIDEO_RECONFIG) {
+            int64_t width = 0, height = 0;
+            mpv_get_property(mpv, "dwidth", MPV_FORMAT_INT64, &width);
+            mpv_get_property(mpv, "dheight", MPV_FORMAT_INT64, &height);
+            if (width > 0 && height > 0 && (width != source_width || height != source_height)) {
+                source_width = width;
+                source_height = height;
+                render_call(update_video_size, NULL);
+            }
+        } else if (event->event_id == MPV_EVENT_FILE_LOADED && !mpv_file_loaded) {
+            mpv_file_loaded = true;
+            if (VERBOSE)
+                cflp_info("Loaded %s", video_path);
+            log_startup("file loaded");
+
+            // Return start pos to default
+            if (mpv_default_start) {
+                mpv_command(mpv, (const char *[]){"set", "start", mpv_default_start, NULL});
+                mpv_free(mpv_default_start);
+                mpv_default_start = NULL;
             }
-        }
 
-        pthread_usleep(10000);
+            // mpv must never idle
+            mpv_command(mpv, (const char *[]){"set", "idle", "no", NULL});
+        } else if (event->event_id == MPV_EVENT_PROPERTY_CHANGE) {
+            if (event->reply_userdata == MPV_OBSERVE_PAUSE)
+                report_mpv_pause();
+        }
     }
+}
 
-    mpv_unobserve_property(mpv, MPV_OBSERVE_PAUSE);
-
-    pthread_exit(NULL);
+static void handle_slideshow_timer(struct reactor_source *source, uint32_t events) {
+    drain_fd(slideshow_fd);
+    if (mpv)
+        mpv_command_async(mpv, 0, (const char *[]){"playlist-next", NULL});
 }
 
-static void init_threads() {
-    uint id = 1;
+// (Re)start the slideshow period from now
+static void arm_slideshow_timer() {
+    if (slideshow_fd < 0)
+        return;
 
-    pthread_create(&threads[id], NULL, handle_mpv_events, NULL);
-    id++;
+    struct itimerspec interval = {
+        .it_interval = {.tv_sec = SLIDESHOW_TIME},
+        .it_value = {.tv_sec = SLIDESHOW_TIME},
+    };
+    if (timerfd_settime(slideshow_fd, 0, &interval, NULL) == -1)
+        cflp_error("Failed to set slideshow timer");
+}
 
-    // Thread for monitoring if mpvpaper is hidden
-    if (halt_info.auto_pause) {
-        pthread_create(&threads[id], NULL, handle_auto_pause, NULL);
-        id++;
-    } else if (halt_info.auto_stop) {
-        pthread_create(&threads[id], NULL, handle_auto_stop, NULL);
-        id++;
+static void init_mpv_events() {
+    mpv_event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (mpv_event_fd == -1) {
+        cflp_error("Creating mpv event eventfd failed");
+        exit_mpvpaper(EXIT_FAILURE);
     }
-
-    // Threads for monitoring watch lists
-    if (halt_info.pauselist) {
-        pthread_create(&threads[id], NULL, monitor_pauselist, NULL);
-        id++;
+    // Timer for switching to the next slideshow video
+    if (SLIDESHOW_TIME) {
+        slideshow_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+        if (slideshow_fd == -1) {
+            cflp_error("Creating slideshow timer failed");
+            exit_mpvpaper(EXIT_FAILURE);
+        }
+        arm_slideshow_timer();
     }
-    if (halt_info.stoplist) {
-        pthread_create(&threads[id], NULL, monitor_stoplist, NULL);
-        id++;
+
+    if (!reactor_add(&reactor, mpv_event_fd, EPOLLIN, handle_mpv_events, NULL) ||
+            (slideshow_fd >= 0 && !reactor_add(&reactor, slideshow_fd, EPOLLIN, handle_slideshow_timer, NULL))) {
+        cflp_error("Failed to watch mpv events");
+        exit_mpvpaper(EXIT_FAILURE);
     }
 }
 
@@ -481,7 +1515,14 @@ static void set_init_mpv_options(const struct wl_state *state) {
     mpv_set_option_string(mpv, "input-terminal", "yes");
     mpv_set_option_string(mpv, "terminal", "yes");
     mpv_set_option_string(mpv, "config", "yes");
-    mpv_set_option_string(mpv, "background-color", "#00000000");
+    mpv_set_option_string(mpv, "background-color", OPAQUE_BUFFERS ? "#000000" : "#00000000");
+
+    // A single output is drawn by mpv directly, so it scales like the blits would
+    // The shared frame already has the video's aspect, where these change nothing
+    if (BLIT_MODE == BLIT_FILL)
+        mpv_set_option_string(mpv, "panscan", "1.0");
+    else if (BLIT_MODE == BLIT_STRETCH)
+        mpv_set_option_string(mpv, "keepaspect", "no");
 
     // Convenience options passed for slideshow mode
     if (SLIDESHOW_TIME != 0) {
@@ -510,13 +1551,6 @@ static void set_init_mpv_options(const struct wl_state *state) {
     }
 }
 
-// Sync fence tracking wrapper to resolve libmpv memory/descriptor leaks by returning NULL
-static GLsync APIENTRY wrap_glFenceSync(GLenum condition, GLbitfield flags) {
-    (void)condition;
-    (void)flags;
-    return NULL;
-}
-
 static void *get_proc_address_mpv(void *ctx, const char *name) {
     (void)ctx;
     if (strcmp(name, "glFenceSync") == 0) {
@@ -534,6 +1568,34 @@ static void render_update_callback(void *callback_ctx) {
     }
 }
 
+// Runs on the render thread, where the context is current
+static void create_render_context(void *data) {
+    const struct wl_state *state = data;
+
+    if (!eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, egl_context))
+        cflp_error("Failed to make context current %s", eglGetErrorString(eglGetError()));
+
+    // Have mpv render onto egl context
+    mpv_render_param params[] = {
+        {MPV_RENDER_PARAM_WL_DISPLAY, state->display},
+        {MPV_RENDER_PARAM_API_TYPE, MPV_RENDER_API_TYPE_OPENGL},
+        {MPV_RENDER_PARAM_OPENGL_INIT_PARAMS, &(mpv_opengl_init_params){
+            .get_proc_address = get_proc_address_mpv,
+        }},
+        {MPV_RENDER_PARAM_INVALID, NULL},
+    };
+    int mpv_err = mpv_render_context_create(&mpv_glcontext, mpv, params);
+    if (mpv_err < 0) {
+        cflp_error("Failed to initialize mpv GL context, %s", mpv_error_string(mpv_err));
+        exit_mpvpaper(EXIT_FAILURE);
+    }
+
+    // Keep what is on screen until mpv has something to show
+    awaiting_first_frame = true;
+
+    mpv_render_context_set_update_callback(mpv_glcontext, render_update_callback, NULL);
+}
+
 static void init_mpv(const struct wl_state *state) {
     int mpv_err;
 
@@ -564,23 +1626,11 @@ static void init_mpv(const struct wl_state *state) {
     }
     mpv_free(vo_option);
 
-    // Have mpv render onto egl context
-    mpv_render_param params[] = {
-        {MPV_RENDER_PARAM_WL_DISPLAY, state->display},
-        {MPV_RENDER_PARAM_API_TYPE, MPV_RENDER_API_TYPE_OPENGL},
-        {MPV_RENDER_PARAM_OPENGL_INIT_PARAMS, &(mpv_opengl_init_params){
-            .get_proc_address = get_proc_address_mpv,
-        }},
-        {MPV_RENDER_PARAM_INVALID, NULL},
-    };
-    mpv_err = mpv_render_context_create(&mpv_glcontext, mpv, params);
-    if (mpv_err < 0) {
-        cflp_error("Failed to initialize mpv GL context, %s", mpv_error_string(mpv_err));
-        exit_mpvpaper(EXIT_FAILURE);
-    }
+    render_call(create_render_context, (void *)state);
+    // Listen before loading so no event of the file is missed
+    start_mpv_events();
 
     // Restore video position after auto stop event
-    char *default_start = NULL;
     if (halt_info.save_info) {
 
         char time_pos[10];
@@ -589,8 +1639,8 @@ static void init_mpv(const struct wl_state *state) {
 
         if (VERBOSE)
             cflp_info("Restoring previous time: %s and playlist position: %s", time_pos, playlist_pos);
-        // Save default start pos
-        default_start = mpv_get_property_string(mpv, "start");
+        // Save default start pos, returned to once the file is loaded
+        mpv_default_start = mpv_get_property_string(mpv, "start");
         // Restore video position
         mpv_command(mpv, (const char *[]){"set", "start", time_pos, NULL});
         // Recover playlist pos, that is if it's not shuffled...
@@ -598,36 +1648,81 @@ static void init_mpv(const struct wl_state *state) {
     }
 
     // Load media or try loading as playlist file
+    // Without waiting, handle_mpv_events() picks up the result
     if (strstr(video_path, "--playlist=") == NULL) {
-        mpv_err = mpv_command(mpv, (const char *[]){"loadfile", video_path, NULL});
+        mpv_err = mpv_command_async(mpv, MPV_REPLY_LOAD, (const char *[]){"loadfile", video_path, NULL});
     } else {
         // cut out "--playlist=" then load as a list file
-        mpv_err = mpv_command(mpv, (const char *[]){"loadlist", video_path + strlen("--playlist="), NULL});
+        mpv_err = mpv_command_async(mpv, MPV_REPLY_LOAD,
+                (const char *[]){"loadlist", video_path + strlen("--playlist="), NULL});
     }
 
     if (mpv_err < 0) {
         cflp_error("Failed to load file, %s", mpv_error_string(mpv_err));
         exit_mpvpaper(EXIT_FAILURE);
     }
+}
 
-    // Wait for file to load
-    mpv_event *event = mpv_wait_event(mpv, 1);
-    while (event->event_id != MPV_EVENT_FILE_LOADED) {
-        event = mpv_wait_event(mpv, 1);
-    }
-    if (VERBOSE)
-        cflp_info("Loaded %s", video_path);
+static bool egl_config_matches(EGLConfig config, bool exact_alpha) {
+    EGLint red, green, blue, alpha;
+    eglGetConfigAttrib(egl_display, config, EGL_RED_SIZE, &red);
+    eglGetConfigAttrib(egl_display, config, EGL_GREEN_SIZE, &green);
+    eglGetConfigAttrib(egl_display, config, EGL_BLUE_SIZE, &blue);
+    eglGetConfigAttrib(egl_display, config, EGL_ALPHA_SIZE, &alpha);
+    return red == buffer_formats[BUFFER_FORMAT].red && green == buffer_formats[BUFFER_FORMAT].green &&
+        blue == buffer_formats[BUFFER_FORMAT].blue && (!exact_alpha || alpha == buffer_formats[BUFFER_FORMAT].alpha);
+}
 
-    // Return start pos to default
-    if (default_start) {
-        mpv_command(mpv, (const char *[]){"set", "start", default_start, NULL});
-        mpv_free(default_start);
-    }
+static void choose_egl_config() {
+    const EGLint win_attrib[] = {
+        EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, buffer_formats[BUFFER_FORMAT].red,
+        EGL_GREEN_SIZE, buffer_formats[BUFFER_FORMAT].green,
+        EGL_BLUE_SIZE, buffer_formats[BUFFER_FORMAT].blue,
+        EGL_ALPHA_SIZE, buffer_formats[BUFFER_FORMAT].alpha,
+        EGL_NONE
+    };
 
-    // mpv must never idle
-    mpv_command(mpv, (const char *[]){"set", "idle", "no", NULL});
+    EGLint num_config = 0;
+    if (!eglChooseConfig(egl_display, win_attrib, NULL, 0, &num_config) || num_config == 0) {
+        cflp_error("Failed to set EGL frame buffer config %s", eglGetErrorString(eglGetError()));
+        exit_mpvpaper(EXIT_FAILURE);
+    }
+    EGLConfig *configs = calloc(num_config, sizeof(EGLConfig));
+    if (!configs) {
+        cflp_error("Failed to allocate EGL configs");
+        exit_mpvpaper(EXIT_FAILURE);
+    }
+    eglChooseConfig(egl_display, win_attrib, configs, num_config, &num_config);
 
-    mpv_render_context_set_update_callback(mpv_glcontext, render_update_callback, NULL);
+    // EGL sorts deeper configs first, so 565 or no alpha has to be searched for
+    int chosen = -1;
+    for (int i=0; i < num_config && chosen < 0; i++) {
+        if (egl_config_matches(configs[i], true))
+            chosen = i;
+    }
+    for (int i=0; i < num_config && chosen < 0; i++) {
+        if (egl_config_matches(configs[i], false))
+            chosen = i;
+    }
+    if (chosen < 0) {
+        cflp_warning("No EGL config is exactly %s, using the closest one", buffer_formats[BUFFER_FORMAT].name);
+        chosen = 0;
+    }
+    egl_config = configs[chosen];
+    free(configs);
+
+    if (VERBOSE) {
+        EGLint id, red, green, blue, alpha;
+        eglGetConfigAttrib(egl_display, egl_config, EGL_CONFIG_ID, &id);
+        eglGetConfigAttrib(egl_display, egl_config, EGL_RED_SIZE, &red);
+        eglGetConfigAttrib(egl_display, egl_config, EGL_GREEN_SIZE, &green);
+        eglGetConfigAttrib(egl_display, egl_config, EGL_BLUE_SIZE, &blue);
+        eglGetConfigAttrib(egl_display, egl_config, EGL_ALPHA_SIZE, &alpha);
+        cflp_info("EGL config %i chosen: R%iG%iB%iA%i%s", id, red, green, blue, alpha,
+                OPAQUE_BUFFERS ? ", opaque" : "");
+    }
 }
 
 static void init_egl(struct wl_state *state) {
@@ -642,21 +1737,7 @@ static void init_egl(struct wl_state *state) {
     }
 
     eglBindAPI(EGL_OPENGL_API);
-    const EGLint win_attrib[] = {
-        EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
-        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
-        EGL_RED_SIZE, 8,
-        EGL_GREEN_SIZE, 8,
-        EGL_BLUE_SIZE, 8,
-        EGL_ALPHA_SIZE, 8,
-        EGL_NONE
-    };
-
-    EGLint num_config;
-    if (!eglChooseConfig(egl_display, win_attrib, &egl_config, 1, &num_config)) {
-        cflp_error("Failed to set EGL frame buffer config %s", eglGetErrorString(eglGetError()));
-        exit_mpvpaper(EXIT_FAILURE);
-    }
+    choose_egl_config();
 
     // Check for OpenGL compatibility for creating egl context
     static const struct { int major, minor; } gl_versions[] = {
@@ -673,6 +1754,8 @@ static void init_egl(struct wl_state *state) {
         };
         egl_context = eglCreateContext(egl_display, egl_config, EGL_NO_CONTEXT, ctx_attrib);
         if (egl_context) {
+            gl_version[0] = gl_versions[i].major;
+            gl_version[1] = gl_versions[i].minor;
             if (VERBOSE)
                 cflp_info("OpenGL %i.%i EGL context created", gl_versions[i].major, gl_versions[i].minor);
             break;
@@ -692,28 +1775,458 @@ static void init_egl(struct wl_state *state) {
         cflp_error("Failed to load OpenGL %s", eglGetErrorString(eglGetError()));
         exit_mpvpaper(EXIT_FAILURE);
     }
+
+    // A context is only current on one thread, the render thread takes it over
+    eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+}
+
+static void save_playback_position() {
+    char *time_pos = mpv_get_property_string(mpv, "time-pos");
+    char *playlist_pos = mpv_get_property_string(mpv, "playlist-pos");
+
+    free(halt_info.save_info);
+    if (asprintf(&halt_info.save_info, "%s %s", time_pos, playlist_pos) < 0)
+        halt_info.save_info = NULL;
+
+    mpv_free(time_pos);
+    mpv_free(playlist_pos);
+}
+
+// Render the current mpv frame into a new framebuffer the size of one image of a poster
+static void render_poster_frame(const struct poster *target, uint32_t index, GLuint *fbo, GLuint *texture) {
+    const struct poster_image *image = &target->header->images[index];
+
+    if (!eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, egl_context))
+        cflp_error("Failed to make context current %s", eglGetErrorString(eglGetError()));
+
+    // Posters are XRGB8888 wl_shm buffers, so 8 bits are all that is kept whatever the buffer format
+    glGenFramebuffers(1, fbo);
+    glGenTextures(1, texture);
+    glBindTexture(GL_TEXTURE_2D, *texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, image->width, image->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, *fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, *texture, 0);
+
+    mpv_render_param render_params[] = {
+        {MPV_RENDER_PARAM_OPENGL_FBO, &(mpv_opengl_fbo) {
+            .fbo = *fbo,
+            .w = image->width,
+            .h = image->height,
+            .internal_format = GL_RGBA8,
+        }},
+        // Unflipped rows read back top to bottom, as wl_shm expects
+        {MPV_RENDER_PARAM_FLIP_Y, &(int){0}},
+        {MPV_RENDER_PARAM_BLOCK_FOR_TARGET_TIME, &(int){0}},
+        {MPV_RENDER_PARAM_INVALID, NULL},
+    };
+    int mpv_err = mpv_render_context_render(mpv_glcontext, render_params);
+    if (mpv_err < 0)
+        cflp_error("Failed to render poster with mpv, %s", mpv_error_string(mpv_err));
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+// Copy a frame from render_poster_frame() into the poster, waits for the GPU
+static void read_poster_frame(const struct poster *target, uint32_t index, GLuint fbo, GLuint texture) {
+    const struct poster_image *image = &target->header->images[index];
+
+    if (!eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, egl_context))
+        cflp_error("Failed to make context current %s", eglGetErrorString(eglGetError()));
+
+    // BGRA bytes are XRGB8888 in little endian
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, image->width, image->height, GL_BGRA, GL_UNSIGNED_BYTE, poster_pixels(target, index));
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteTextures(1, &texture);
+}
+
+static void read_mpv_frame(const struct poster *target, uint32_t index) {
+    GLuint fbo, texture;
+    render_poster_frame(target, index, &fbo, &texture);
+    read_poster_frame(target, index, fbo, texture);
+}
+
+// Render the current frame of every output into a new poster for mpvpaper-holder
+static void capture_posters(void *data) {
+    uint32_t count = 0;
+    struct display_output *output;
+    wl_list_for_each(output, &render_outputs, render_link) {
+        if (output->name)
+            count++;
+    }
+    if (count == 0 || !mpv_glcontext)
+        return;
+
+    struct poster_image *images = calloc(count, sizeof(struct poster_image));
+    if (!images)
+        return;
+    uint32_t i = 0;
+    wl_list_for_each(output, &render_outputs, render_link) {
+        if (!output->name)
+            continue;
+        snprintf(images[i].output, sizeof(images[i].output), "%s", output->name);
+        images[i].width = output->width * output->scale;
+        images[i].height = output->height * output->scale;
+        images[i].scale = output->scale;
+        i++;
+    }
+
+    struct poster new_poster;
+    bool created = poster_create(&new_poster, images, count);
+    free(images);
+    if (!created) {
+        cflp_warning("Failed to create poster");
+        return;
+    }
+
+    for (i=0; i < count; i++)
+        read_mpv_frame(&new_poster, i);
+
+    poster_finish(&poster);
+    poster = new_poster;
+
+    if (VERBOSE)
+        cflp_info("Captured a poster for %u outputs", count);
+}
+
+static void init_poster_cache() {
+    // A restored position is not the first frame
+    if (halt_info.save_info)
+        return;
+
+    // Only local files have a stable identity
+    const char *path = video_path;
+    if (strstr(path, "--playlist=") == path)
+        path += strlen("--playlist=");
+    char *real_path = realpath(path, NULL);
+    struct stat st;
+    if (!real_path || stat(real_path, &st) < 0) {
+        free(real_path);
+        return;
+    }
+
+    // FNV-1a over everything that changes what the first frame looks like
+    uint64_t hash = 14695981039346656037u;
+    const struct { const void *data; size_t size; } fields[] = {
+        {real_path, strlen(real_path)},
+        {&st.st_mtim, sizeof(st.st_mtim)},
+        {&st.st_size, sizeof(st.st_size)},
+        {mpv_options, strlen(mpv_options)},
+    };
+    for (uint i=0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        for (size_t j=0; j < fields[i].size; j++) {
+            hash ^= ((const unsigned char *)fields[i].data)[j];
+            hash *= 1099511628211u;
+        }
+    }
+    free(real_path);
+
+    const char *cache_home = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    if (!home || !home[0]) {
+        struct passwd *pw = getpwuid(getuid());
+        home = pw ? pw->pw_dir : NULL;
+    }
+    int err;
+    if (cache_home && cache_home[0])
+        err = asprintf(&poster_cache_dir, "%s/mpvpaper", cache_home);
+    else if (home)
+        err = asprintf(&poster_cache_dir, "%s/.cache/mpvpaper", home);
+    else
+        return; // Nowhere to keep it
+    if (err < 0) {
+        poster_cache_dir = NULL;
+        return;
+    }
+
+    // Create every missing parent, like mkdir -p
+    for (char *slash = strchr(poster_cache_dir + 1, '/'); ; slash = strchr(slash + 1, '/')) {
+        if (slash)
+            *slash = '\0';
+        bool failed = mkdir(poster_cache_dir, 0700) < 0 && errno != EEXIST;
+        if (slash)
+            *slash = '/';
+        if (failed) {
+            cflp_warning("Failed to create poster cache %s", poster_cache_dir);
+            return;
+        }
+        if (!slash)
+            break;
+    }
+
+    poster_cache_key = hash ? hash : 1;
+}
+
+static char *cached_poster_path(const struct display_output *output) {
+    char *path = NULL;
+    if (asprintf(&path, "%s/%016llx-%ux%u.poster", poster_cache_dir, (unsigned long long)poster_cache_key,
+                output->width * output->scale, output->height * output->scale) < 0)
+        return NULL;
+    return path;
+}
+
+static bool open_cached_poster(struct display_output *output, struct poster *cached) {
+    if (!poster_cache_key)
+        return false;
+
+    char *path = cached_poster_path(output);
+    if (!path)
+        return false;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    free(path);
+    if (fd < 0)
+        return false;
+    if (!poster_open(cached, fd) || cached->header->count == 0) {
+        poster_finish(cached);
+        close(fd);
+        return false;
+    }
+
+    // Mark as recently used for poster_prune()
+    futimens(fd, NULL);
+    output->poster_cached = true;
+    return true;
+}
+
+struct poster_cache_job {
+    struct poster poster;
+    char *path;
+
+    // First frame waiting for readback, render thread only
+    GLuint fbo, texture;
+    struct poster_cache_job *next;
+};
+
+// Writing runs on the main loop, see write_cached_poster()
+static void free_poster_cache_job(struct poster_cache_job *job) {
+    poster_finish(&job->poster);
+    free(job->path);
+    free(job);
+}
+
+static void write_cached_poster(struct poster_cache_job *job) {
+    bool saved = poster_save(&job->poster, job->path);
+    if (VERBOSE)
+        cflp_info("%s poster %s", saved ? "Cached" : "Failed to cache", job->path);
+    free_poster_cache_job(job);
 }
 
-static struct toplevel_handle_state *match_toplevel_handle(struct wl_state *wl_state,
-        struct zwlr_foreign_toplevel_handle_v1 *toplevel_handle) {
+// Keep the first frame of every output size not cached yet
+// mpv draws it right away, the readback waits until it is on screen, see save_cached_posters()
+static void render_cached_posters() {
+    if (!poster_cache_key || !mpv_glcontext)
+        return;
+
+    struct display_output *output;
+    wl_list_for_each(output, &render_outputs, render_link) {
+        if (output->poster_cached)
+            continue;
+
+        char *path = cached_poster_path(output);
+        if (!path)
+            continue;
+        // Another output of the same size may have saved it already
+        if (access(path, F_OK) == 0) {
+            output->poster_cached = true;
+            free(path);
+            continue;
+        }
+
+        struct poster_image image = {
+            .width = output->width * output->scale,
+            .height = output->height * output->scale,
+            .scale = output->scale,
+        };
+        snprintf(image.output, sizeof(image.output), "%s", output->name ? output->name : "");
+        struct poster_cache_job *job = calloc(1, sizeof(struct poster_cache_job));
+        if (!job || !poster_create(&job->poster, &image, 1)) {
+            cflp_error("Failed to allocate poster %s", path);
+            free(job);
+            free(path);
+            continue;
+        }
+        render_poster_frame(&job->poster, 0, &job->fbo, &job->texture);
+        job->path = path;
+        job->next = poster_cache_jobs;
+        poster_cache_jobs = job;
+        // Tried once, a failed write is not worth another readback
+        output->poster_cached = true;
+    }
+}
+
+// Only the readback needs the render thread, the disk is left to the main loop
+static void save_cached_posters() {
+    while (poster_cache_jobs) {
+        struct poster_cache_job *job = poster_cache_jobs;
+        poster_cache_jobs = job->next;
+        read_poster_frame(&job->poster, 0, job->fbo, job->texture);
+        if (!send_render_event(RENDER_EVENT_CACHE, job))
+            free_poster_cache_job(job);
+    }
+}
+
+// Show the frame handed over by -P or cached on disk until mpv renders one itself
+static void attach_poster(struct display_output *output) {
+    if (!output->state->shm)
+        return;
+
+    struct poster *source = &poster;
+    const struct poster_image *image = poster_find(&poster, output->name);
+    struct poster cached = {.fd = -1};
+    if (!image && open_cached_poster(output, &cached)) {
+        source = &cached;
+        image = &cached.header->images[0];
+    }
+
+    // Only exact fits, anything else waits for mpv
+    if (image && image->scale == output->scale && image->width == output->width * output->scale &&
+            image->height == output->height * output->scale) {
+        output->poster_buffer = poster_create_buffer(source, output->state->shm, image);
+        wl_surface_attach(output->surface, output->poster_buffer, 0, 0);
+        wl_surface_damage(output->surface, 0, 0, output->width, output->height);
+        wl_surface_commit(output->surface);
+
+        if (VERBOSE)
+            cflp_info("Showing %s poster on %s", source == &cached ? "cached" : "last", output->name);
+    }
+
+    // The compositor got its own copy of the fd
+    poster_finish(&cached);
+}
+
+// Keep the last frame on screen and ask to be told when it is seen
+static void request_hibernate_frames(void *data) {
+    struct display_output *output;
+    wl_list_for_each(output, &render_outputs, render_link) {
+        if (!output->frame_callback) {
+            output->frame_callback = wl_surface_frame(output->render_surface);
+            wl_callback_add_listener(output->frame_callback, &wl_surface_frame_listener, output);
+            wl_surface_damage(output->surface, 0, 0, output->width, output->height);
+            wl_surface_commit(output->surface);
+        }
+    }
+}
+
+static void hibernate_render(void *data) {
+    if (!eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, egl_context))
+        cflp_error("Failed to make context current %s", eglGetErrorString(eglGetError()));
+
+    halt_info.hibernating = 1;
+    free_render_context();
+
+    shared_render.valid = false;
+
+    request_hibernate_frames(NULL);
+}
+
+static void hibernate_mpvpaper(struct wl_state *state) {
+    save_playback_position();
+
+    // No more wakeups once its handle goes away
+    stop_mpv_events();
+
+    // Only mpv is torn down, Wayland surfaces and the EGL context stay alive
+    halt_info.hibernate_visible = 0;
+    render_call(hibernate_render, NULL);
+    mpv_terminate_destroy(mpv);
+    mpv = NULL;
+
+    if (VERBOSE)
+        cflp_info("mpv is hibernating");
+}
+
+static void revive_mpvpaper(struct wl_state *state) {
+    if (!halt_info.hibernating)
+        return;
+    if (is_blocked()) {
+        halt_info.hibernate_visible = 0;
+        return;
+    }
+    // Auto stop must see the wallpaper drawn first, the callback only arrives when visible
+    if (halt_info.auto_stop && !halt_info.hibernate_visible) {
+        render_call(request_hibernate_frames, NULL);
+        return;
+    }
+
+    if (VERBOSE)
+        cflp_info("Reviving mpv");
+
+    init_mpv(state);
+
+    // A new mpv starts unpaused, reapply any remaining pause reasons
+    pause_reset(&pause_state);
+    pause_swap_reason(&pause_state, PAUSE_AUTO, false);
+    halt_info.hibernating = 0;
+    apply_pause_state();
+
+    arm_slideshow_timer();
+
+    // The last frame stays up until the render wakeup brings mpv's first one
+}
+
+static void stop_mpvpaper(struct wl_state *state) {
+    if (halt_info.hibernating)
+        return;
+    if (HIBERNATE) {
+        hibernate_mpvpaper(state);
+        return;
+    }
+
+    // Save video position to arg -Z
+    save_playback_position();
+    // And the last frame to arg -P, unless the old poster is still all there is
+    if (!awaiting_first_frame)
+        render_call(capture_posters, NULL);
+
+    char **new_argv = calloc(halt_info.argc + 5, sizeof(char *)); // Plus 5 for adding in -Z and -P
+    if (!new_argv) {
+        cflp_error("Failed to allocate new argv");
+        exit(EXIT_FAILURE);
+    }
+
+    uint i = 0;
+    for (i=0; i < halt_info.argc; i++) {
+        new_argv[i] = strdup(halt_info.argv_copy[i]);
+    }
+    new_argv[i] = strdup("-Z");
+    new_argv[i+1] = strdup(halt_info.save_info ? halt_info.save_info : "");
+    char poster_fd[16];
+    snprintf(poster_fd, sizeof(poster_fd), "%i", poster.fd);
+    new_argv[i+2] = strdup("-P");
+    new_argv[i+3] = strdup(poster_fd);
+    new_argv[i+4] = NULL;
+
+    // Get the "real" cwd
+    char exe_dir[1024];
+    int cut_point = readlink("/proc/self/exe", exe_dir, sizeof(exe_dir));
+    for (uint i=cut_point; i > 1; i--) {
+        if (exe_dir[i] == '/') {
+            exe_dir[i+1] = '\0';
+            break;
+        }
+    }
+
+    exit_cleanup();
 
-    struct toplevel_handle_state *handle_state;
-    wl_list_for_each(handle_state, &wl_state->toplevel_handles, link) {
+    // The only fd the holder inherits
+    if (poster.fd >= 0 && !poster_set_inherit(&poster, true))
+        cflp_warning("Failed to hand over the last frame");
 
-        if(handle_state->handle == toplevel_handle)
-            return handle_state;
-    }
+    // Start holder script, signals are only blocked for the signalfd
+    sigprocmask(SIG_SETMASK, &old_sigmask, NULL);
+    execv(strcat(exe_dir, "mpvpaper-holder"), new_argv);
 
-    return NULL;
+    cflp_error("Failed to stop mpvpaper");
+    exit(EXIT_FAILURE);
 }
 
 static void toplevel_title(void *data, struct zwlr_foreign_toplevel_handle_v1 *toplevel_handle,
         const char *title) {
 
-    struct wl_state *wl_state = data;
-
-    struct toplevel_handle_state *handle_state = match_toplevel_handle(wl_state, toplevel_handle);
-    if (!handle_state) return;
+    struct toplevel_handle_state *handle_state = data;
 
     if (handle_state->title) free(handle_state->title);
 
@@ -723,50 +2236,135 @@ static void toplevel_title(void *data, struct zwlr_foreign_toplevel_handle_v1 *t
 static void toplevel_app_id(void *data, struct zwlr_foreign_toplevel_handle_v1 *toplevel_handle,
         const char *app_id) { /* NOP */ }
 
-static void toplevel_output_enter(void *data, struct zwlr_foreign_toplevel_handle_v1 *toplevel_handle,
-        struct wl_output *output) { /* NOP */ }
+static struct display_output *find_display_output(struct wl_state *wl_state, struct wl_output *wl_output) {
+    struct display_output *output;
+    wl_list_for_each(output, &wl_state->outputs, link) {
+        if (output->wl_output == wl_output)
+            return output;
+    }
+    return NULL;
+}
 
-static void toplevel_output_leave(void *data, struct zwlr_foreign_toplevel_handle_v1 *toplevel_handle,
-        struct wl_output *output) { /* NOP */ }
+static bool auto_mode_enabled() {
+    return halt_info.auto_pause > 1 || halt_info.auto_stop > 1;
+}
 
-static void check_handle_blocking(struct toplevel_handle_state *handle_state, struct wl_state *wl_state,
-        bool currently_blocking) {
+// Resume once windows stayed away for UNPAUSE_DELAY
+static void unblock_windows() {
+    unblock_pending = false;
+    halt_info.window_blocking = false;
 
-    if (handle_state->is_blocking != currently_blocking) {
-        handle_state->is_blocking = currently_blocking;
+    window_stats.toggles++;
+    set_pause_reason(PAUSE_FULL, false, "Blocking Windows");
+    if (halt_info.hibernating)
+        request_revive();
+}
 
-        // Calculate if ANY window is still blocking the screen
-        bool any_blocking = false;
-        struct toplevel_handle_state *iter_handle;
-        wl_list_for_each(iter_handle, &wl_state->toplevel_handles, link) {
-            if (iter_handle->is_blocking) {
-                any_blocking = true;
-                break;
-            }
+// Pause/stop only once every output is covered
+static void update_window_blocking(struct wl_state *wl_state, const char *reason) {
+    bool all_hidden = false;
+    struct display_output *output;
+    wl_list_for_each(output, &wl_state->outputs, link) {
+        if (!output->layer_surface)
+            continue;
+        if (!output_hidden(output)) {
+            all_hidden = false;
+            break;
+        }
+        all_hidden = true;
+    }
+
+    if (all_hidden) {
+        // Covered again before resuming, e.g. while switching workspaces
+        if (unblock_pending) {
+            unblock_pending = false;
+            timerfd_settime(unblock_timer_fd, 0, &(struct itimerspec){0}, NULL);
+            window_stats.suppressed++;
+            if (VERBOSE == 2)
+                cflp_info("Resume suppressed by %s", reason);
+            return;
         }
+        if (halt_info.window_blocking)
+            return;
+        halt_info.window_blocking = true;
 
-        if (any_blocking) {
-            if (halt_info.auto_stop) {
-                if (VERBOSE)
-                    cflp_info("Stopping for %s", iter_handle->title);
+        window_stats.toggles++;
+        if (halt_info.auto_stop && !halt_info.hibernating) {
+            if (VERBOSE)
+                cflp_info("Stopping for %s", reason);
 
-                stop_mpvpaper();
-            }
-            if (!halt_info.full_paused && !halt_info.mpv_paused)
-                update_mpv_pause_state(&halt_info.full_paused, true, iter_handle->title);
+            request_stop();
+        }
+        set_pause_reason(PAUSE_FULL, true, reason);
 
-        } else { // No windows are blocking anymore
-            update_mpv_pause_state(&halt_info.full_paused, false, "Blocking Windows");
+    } else if (halt_info.window_blocking && !unblock_pending) { // Some output can be seen again
+        if (UNPAUSE_DELAY == 0) {
+            unblock_windows();
+            return;
+        }
+
+        struct itimerspec delay = {
+            .it_value = {.tv_sec = UNPAUSE_DELAY / 1000, .tv_nsec = (UNPAUSE_DELAY % 1000) * 1000000L},
+        };
+        if (timerfd_settime(unblock_timer_fd, 0, &delay, NULL) == -1) {
+            unblock_windows();
+            return;
         }
+        unblock_pending = true;
     }
 }
 
+static void render_uncovered(void *data) {
+    struct display_output *output = data;
+    if (output->redraw_needed && !output->frame_callback)
+        render(output);
+}
+
+// Add or remove a blocking window from one output
+static void block_output(void *data, struct wl_output *wl_output, bool blocking) {
+    struct wl_state *wl_state = data;
+    struct display_output *output = find_display_output(wl_state, wl_output);
+    if (!output)
+        return;
+
+    bool was_hidden = output_hidden(output);
+    if (blocking)
+        output->blocking_windows++;
+    else if (output->blocking_windows > 0)
+        output->blocking_windows--;
+
+    if (VERBOSE == 2 && was_hidden != output_hidden(output))
+        cflp_info("%s is %s", output->name, was_hidden ? "uncovered" : "covered by a window");
+
+    // Catch up on frames skipped while covered
+    if (was_hidden && !output_hidden(output))
+        render_call(render_uncovered, output);
+}
+
+// Apply everything staged since the last done at once
+static void apply_handle_state(struct toplevel_handle_state *handle_state) {
+    if (window_commit(&handle_state->window, block_output, handle_state->state))
+        update_window_blocking(handle_state->state, handle_state->title);
+}
+
+static void toplevel_output_enter(void *data, struct zwlr_foreign_toplevel_handle_v1 *toplevel_handle,
+        struct wl_output *output) {
+
+    struct toplevel_handle_state *handle_state = data;
+    window_output_enter(&handle_state->window, output);
+}
+
+static void toplevel_output_leave(void *data, struct zwlr_foreign_toplevel_handle_v1 *toplevel_handle,
+        struct wl_output *output) {
+
+    struct toplevel_handle_state *handle_state = data;
+    window_output_leave(&handle_state->window, output);
+}
+
 static void toplevel_state(void *data, struct zwlr_foreign_toplevel_handle_v1 *toplevel_handle,
         struct wl_array *state) {
 
-    struct wl_state *wl_state = data;
-    struct toplevel_handle_state *handle_state = match_toplevel_handle(wl_state, toplevel_handle);
-    if (!handle_state) return;
+    struct toplevel_handle_state *handle_state = data;
 
     uint32_t *s;
     bool currently_blocking = false;
@@ -776,30 +2374,35 @@ static void toplevel_state(void *data, struct zwlr_foreign_toplevel_handle_v1 *t
             currently_blocking = true;
             break;
         } else if (*s == ZWLR_FOREIGN_TOPLEVEL_HANDLE_V1_STATE_MAXIMIZED) {
-            if (halt_info.auto_pause > 2 || halt_info.auto_stop > 2) {
+            // Maximized windows stay below the top layer
+            bool below_top = handle_state->state->surface_layer != ZWLR_LAYER_SHELL_V1_LAYER_TOP;
+            if (below_top && (halt_info.auto_pause > 2 || halt_info.auto_stop > 2)) {
                 currently_blocking = true;
                 break;
             }
         }
     }
 
-    check_handle_blocking(handle_state, wl_state, currently_blocking);
+    window_set_blocking(&handle_state->window, currently_blocking);
 }
 
-static void toplevel_done(void *data, struct zwlr_foreign_toplevel_handle_v1 *toplevel_handle) { /* NOP */ }
+static void toplevel_done(void *data, struct zwlr_foreign_toplevel_handle_v1 *toplevel_handle) {
+    apply_handle_state(data);
+}
 
 static void toplevel_closed(void *data, struct zwlr_foreign_toplevel_handle_v1 *toplevel_handle) {
 
-    struct wl_state *wl_state = data;
-
-    struct toplevel_handle_state *handle_state = match_toplevel_handle(wl_state, toplevel_handle);
-    if (!handle_state) return;
+    struct toplevel_handle_state *handle_state = data;
 
-    if(handle_state->is_blocking)
-        check_handle_blocking(handle_state, wl_state, false);
+    // No done follows closed
+    window_set_blocking(&handle_state->window, false);
+    handle_state->window.changed = true;
+    apply_handle_state(handle_state);
 
     // Destroy handle
+    zwlr_foreign_toplevel_handle_v1_destroy(toplevel_handle);
     wl_list_remove(&handle_state->link);
+    window_finish(&handle_state->window);
     free(handle_state->title);
     free(handle_state);
 }
@@ -824,11 +2427,18 @@ static void toplevel_created(void *data, struct zwlr_foreign_toplevel_manager_v1
     struct wl_state *state = data;
 
     struct toplevel_handle_state *handle_state = calloc(1, sizeof(struct toplevel_handle_state));
+    if (!handle_state) {
+        cflp_error("Failed to allocate window state");
+        zwlr_foreign_toplevel_handle_v1_destroy(toplevel_handle);
+        return;
+    }
 
     handle_state->handle = toplevel_handle;
+    handle_state->state = state;
     wl_list_insert(&state->toplevel_handles, &handle_state->link);
 
-    zwlr_foreign_toplevel_handle_v1_add_listener(handle_state->handle, &toplevel_handle_listener, state);
+    // Events find their state directly instead of searching every window
+    zwlr_foreign_toplevel_handle_v1_add_listener(handle_state->handle, &toplevel_handle_listener, handle_state);
 }
 
 static void toplevel_finished(void *data, struct zwlr_foreign_toplevel_manager_v1 *toplevel_manager) { /* NOP */ }
@@ -838,20 +2448,53 @@ static const struct zwlr_foreign_toplevel_manager_v1_listener toplevel_manager_l
     .finished = toplevel_finished,
 };
 
-static void destroy_display_output(struct display_output *output) {
-    if (!output) return;
+// Everything of an output the render thread draws with
+static void destroy_output_render(void *data) {
+    struct display_output *output = data;
 
-    wl_list_remove(&output->link);
-    if (output->egl_surface)
+    if (DYNAMIC_SCALE && VERBOSE && output->egl_surface)
+        cflp_info("%s rendered at %.0f%% after %u steps, %.1f ms per render", output->name,
+                output->dynamic_scale * 100, output->scale_steps, output->render_cost / 1e3);
+    // Gone with the context on exit
+    if (output->timer_queries[0][0] && eglGetCurrentContext() == egl_context)
+        glDeleteQueries(4, &output->timer_queries[0][0]);
+
+    if (output->worker)
+        stop_output_worker(output->worker);
+    if (output->egl_surface) {
+        wl_list_remove(&output->render_link);
         eglDestroySurface(egl_display, output->egl_surface);
+        shared_render.dirty = true;
+    }
     if (output->egl_window)
         wl_egl_window_destroy(output->egl_window);
+    if (output->poster_buffer)
+        wl_buffer_destroy(output->poster_buffer);
+    if (output->frame_callback)
+        wl_callback_destroy(output->frame_callback);
+    if (output->render_surface)
+        wl_proxy_wrapper_destroy(output->render_surface);
+}
+
+static void destroy_display_output(struct display_output *output) {
+    if (!output) return;
+
+    wl_list_remove(&output->link);
+    render_call(destroy_output_render, output);
+    if (output->fractional_scale)
+        wp_fractional_scale_v1_destroy(output->fractional_scale);
+    if (output->viewport)
+        wp_viewport_destroy(output->viewport);
     if (output->layer_surface != NULL)
         zwlr_layer_surface_v1_destroy(output->layer_surface);
     if (output->surface != NULL)
         wl_surface_destroy(output->surface);
-    if (output->frame_callback)
-        wl_callback_destroy(output->frame_callback);
+
+    // Windows can't stay on an output that is gone, its proxy address may be reused
+    struct toplevel_handle_state *handle_state;
+    wl_list_for_each(handle_state, &output->state->toplevel_handles, link) {
+        window_forget_output(&handle_state->window, output->wl_output);
+    }
     wl_output_destroy(output->wl_output);
 
     free(output->name);
@@ -859,27 +2502,188 @@ static void destroy_display_output(struct display_output *output) {
     free(output);
 }
 
-static void layer_surface_configure(void *data, struct zwlr_layer_surface_v1 *surface, uint32_t serial, uint32_t width,
-        uint32_t height) {
+struct output_configure {
+    struct display_output *output;
+    uint32_t width, height;
+};
+
+// Sizes the surface on the render thread, which draws it right away
+// Pick the render size, the full output unless -r caps it
+static void update_buffer_size(struct display_output *output) {
+    uint32_t full_width = output->width * output->scale;
+    uint32_t full_height = output->height * output->scale;
+    // Exactly the preferred fractional size instead of the next integer scale, only a viewport can map it
+    uint32_t preferred_scale = output->preferred_scale;
+    if (output->viewport && preferred_scale) {
+        full_width = (output->width * preferred_scale + 60) / 120;
+        full_height = (output->height * preferred_scale + 60) / 120;
+    }
+    output->buffer_width = full_width;
+    output->buffer_height = full_height;
+    if (!output->viewport || full_width == 0 || full_height == 0)
+        return;
+
+    // Shrink by one factor so the output's aspect ratio stays and mpv letterboxes as usual
+    double factor = 1.0;
+    uint32_t video_width = source_width, video_height = source_height;
+    if (RENDER_SOURCE && video_width && video_height) {
+        // Just enough that the fitted video is drawn at its own size
+        double factor_w = (double)video_width / full_width;
+        double factor_h = (double)video_height / full_height;
+        factor = factor_w > factor_h ? factor_w : factor_h;
+    } else if (RENDER_WIDTH) {
+        double factor_w = (double)RENDER_WIDTH / full_width;
+        double factor_h = (double)RENDER_HEIGHT / full_height;
+        factor = factor_w < factor_h ? factor_w : factor_h;
+    }
+    if (factor > 1.0)
+        factor = 1.0;
+    factor *= output->dynamic_scale;
+    if (factor >= 1.0)
+        return;
+
+    output->buffer_width = full_width * factor + 0.5;
+    output->buffer_height = full_height * factor + 0.5;
+    if (output->buffer_width == 0)
+        output->buffer_width = 1;
+    if (output->buffer_height == 0)
+        output->buffer_height = 1;
+}
+
+static void resize_egl_window(struct display_output *output) {
+    if (output->worker) {
+        // The EGL window belongs to the worker's surface
+        output->worker->resize_width = output->buffer_width;
+        output->worker->resize_height = output->buffer_height;
+        queue_worker_job(output->worker, WORKER_RESIZE);
+    } else {
+        wl_egl_window_resize(output->egl_window, output->buffer_width, output->buffer_height, 0, 0);
+    }
+    shared_render.dirty = true;
+}
+
+// Step the render size down when renders eat most of a refresh, and back up once there is room again
+static void update_dynamic_scale(struct display_output *output, int64_t cpu_time) {
+    if (!DYNAMIC_SCALE)
+        return;
+
+    int64_t cost = cpu_time > output->gpu_time ? cpu_time : output->gpu_time;
+    output->render_cost = output->render_cost ? (output->render_cost * 7 + cost) / 8 : cost;
+    if (++output->cost_samples < DYNAMIC_SCALE_SAMPLES)
+        return;
+    output->cost_samples = 0;
+
+    // mpv still needs time to decode, so renders may only use part of a refresh
+    int64_t budget = output->refresh > 0 ? 1000000000LL / output->refresh : 16667;
+    double scale = output->dynamic_scale;
+    if (output->render_cost > budget * 8 / 10)
+        scale *= DYNAMIC_SCALE_STEP;
+    else if (output->render_cost < budget / 2)
+        scale /= DYNAMIC_SCALE_STEP;
+    if (scale < DYNAMIC_SCALE_MIN)
+        scale = DYNAMIC_SCALE_MIN;
+    if (scale > 1.0)
+        scale = 1.0;
+    if (scale == output->dynamic_scale)
+        return;
+
+    output->dynamic_scale = scale;
+    output->scale_steps++;
+    if (VERBOSE == 2)
+        cflp_info("%s takes %.1f ms of a %.1f ms refresh, rendering at %.0f%%", output->name,
+                output->render_cost / 1e3, budget / 1e3, scale * 100);
+
+    // A viewport lets the compositor scale a smaller buffer, otherwise mpv's target shrinks
+    if (output->viewport) {
+        update_buffer_size(output);
+        resize_egl_window(output);
+    } else {
+        shared_render.dirty = true;
+    }
+}
 
+// The output's integer or fractional scale changed
+static void refresh_buffer_size(void *data) {
     struct display_output *output = data;
+    if (!output->egl_window)
+        return;
+
+    wl_surface_set_buffer_scale(output->surface, output->viewport ? 1 : output->scale);
+    uint32_t old_width = output->buffer_width, old_height = output->buffer_height;
+    update_buffer_size(output);
+    if (output->buffer_width == old_width && output->buffer_height == old_height)
+        return;
+
+    if (VERBOSE)
+        cflp_info("Rendering %s at %ux%u", output->name, output->buffer_width, output->buffer_height);
+    resize_egl_window(output);
+    if (!output->frame_callback)
+        render(output);
+}
+
+// The video size changed, the shared target follows its aspect and -r SOURCE its size
+static void update_video_size(void *data) {
+    shared_render.dirty = true;
+    if (!RENDER_SOURCE)
+        return;
+
+    struct display_output *output;
+    wl_list_for_each(output, &render_outputs, render_link) { refresh_buffer_size(output); }
+}
+
+static void configure_output(void *data) {
+    const struct output_configure *configure = data;
+    struct display_output *output = configure->output;
+    uint32_t width = configure->width;
+    uint32_t height = configure->height;
+
     output->width = width;
     output->height = height;
-    zwlr_layer_surface_v1_ack_configure(surface, serial);
-    wl_surface_set_buffer_scale(output->surface, output->scale);
+    // The viewport maps any buffer size onto the surface, which buffer scales must divide evenly
+    wl_surface_set_buffer_scale(output->surface, output->viewport ? 1 : output->scale);
 
     // Ignore bad surfaces
     if (width == 0 || height == 0) return;
 
+    update_buffer_size(output);
+    if (output->viewport) {
+        wp_viewport_set_destination(output->viewport, width, height);
+        if (VERBOSE && (output->buffer_width != width * output->scale ||
+                    output->buffer_height != height * output->scale))
+            cflp_info("Rendering %s at %ux%u", output->name, output->buffer_width, output->buffer_height);
+    }
+
+    if (!startup.configured) {
+        startup.configured = true;
+        log_startup("first surface configured");
+    }
+
     if (!output->egl_window) {
-        output->egl_window = wl_egl_window_create(output->surface, output->width * output->scale,
-                output->height * output->scale);
+        if (awaiting_first_frame)
+            attach_poster(output);
+
+        output->egl_window = wl_egl_window_create(output->surface, output->buffer_width, output->buffer_height);
         output->egl_surface = eglCreatePlatformWindowSurface(egl_display, egl_config, output->egl_window, NULL);
         if (!output->egl_surface) {
             cflp_error("Failed to create EGL surface for %s %s", output->name, eglGetErrorString(eglGetError()));
             destroy_display_output(output);
             return;
         }
+        wl_list_insert(&render_outputs, &output->render_link);
+
+        // Frame callbacks must not be dispatched by the main thread
+        output->render_surface = wl_proxy_create_wrapper(output->surface);
+        wl_proxy_set_queue((struct wl_proxy *)output->render_surface, render_queue);
+
+        shared_render.dirty = true;
+        if (OUTPUT_THREADS) {
+            output->worker = start_output_worker(output);
+            if (output->worker) {
+                render(output);
+                return;
+            }
+            cflp_warning("Failed to start a render thread for %s, drawing it with the others", output->name);
+        }
 
         if (!eglMakeCurrent(egl_display, output->egl_surface, output->egl_surface, egl_context))
             cflp_error("Failed to make output surface current %s", eglGetErrorString(eglGetError()));
@@ -890,15 +2694,22 @@ static void layer_surface_configure(void *data, struct zwlr_layer_surface_v1 *su
         // So we are going to force GL_BACK just like Mesa's EGL implementation
         glDrawBuffer(GL_BACK);
 
-        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClearColor(0.0f, 0.0f, 0.0f, OPAQUE_BUFFERS ? 1.0f : 0.0f);
 
         // Start render loop
         render(output);
     } else {
-        wl_egl_window_resize(output->egl_window, output->width * output->scale, output->height * output->scale, 0, 0);
+        resize_egl_window(output);
     }
 }
 
+static void layer_surface_configure(void *data, struct zwlr_layer_surface_v1 *surface, uint32_t serial, uint32_t width,
+        uint32_t height) {
+
+    zwlr_layer_surface_v1_ack_configure(surface, serial);
+    render_call(configure_output, &(struct output_configure){data, width, height});
+}
+
 static void layer_surface_closed(void *data, struct zwlr_layer_surface_v1 *surface) {
     (void)surface;
 
@@ -913,6 +2724,22 @@ static const struct zwlr_layer_surface_v1_listener layer_surface_listener = {
     .closed = layer_surface_closed,
 };
 
+static void fractional_preferred_scale(void *data, struct wp_fractional_scale_v1 *fractional_scale, uint32_t scale) {
+    (void)fractional_scale;
+
+    struct display_output *output = data;
+    if (output->preferred_scale == scale)
+        return;
+    output->preferred_scale = scale;
+    if (VERBOSE == 2)
+        cflp_info("%s prefers a scale of %.3f", output->name, scale / 120.0);
+    render_call(refresh_buffer_size, output);
+}
+
+static const struct wp_fractional_scale_v1_listener fractional_scale_listener = {
+    .preferred_scale = fractional_preferred_scale,
+};
+
 static void create_layer_surface(struct display_output *output) {
     output->surface = wl_compositor_create_surface(output->state->compositor);
 
@@ -921,6 +2748,25 @@ static void create_layer_surface(struct display_output *output) {
     wl_surface_set_input_region(output->surface, input_region);
     wl_region_destroy(input_region);
 
+    // Lets the compositor skip blending and scan the wallpaper out directly, it is clipped to the surface
+    if (OPAQUE_BUFFERS) {
+        struct wl_region *opaque_region = wl_compositor_create_region(output->state->compositor);
+        wl_region_add(opaque_region, 0, 0, INT32_MAX, INT32_MAX);
+        wl_surface_set_opaque_region(output->surface, opaque_region);
+        wl_region_destroy(opaque_region);
+    }
+
+    // Fractional scales need the viewport to map their buffer onto the surface
+    struct wl_state *state = output->state;
+    bool fractional = state->viewporter && state->fractional_scale_manager;
+    if (state->viewporter && (fractional || RENDER_SOURCE || RENDER_WIDTH || DYNAMIC_SCALE))
+        output->viewport = wp_viewporter_get_viewport(state->viewporter, output->surface);
+    if (fractional) {
+        output->fractional_scale = wp_fractional_scale_manager_v1_get_fractional_scale(
+                state->fractional_scale_manager, output->surface);
+        wp_fractional_scale_v1_add_listener(output->fractional_scale, &fractional_scale_listener, output);
+    }
+
     output->layer_surface = zwlr_layer_shell_v1_get_layer_surface(
         output->state->layer_shell, output->surface, output->wl_output, output->state->surface_layer, "mpvpaper");
 
@@ -940,7 +2786,12 @@ static void output_geometry(void *data, struct wl_output *wl_output, int32_t x,
         int32_t physical_height, int32_t subpixel, const char *make, const char *model, int32_t transform) { /* NOP */ }
 
 static void output_mode(void *data, struct wl_output *wl_output, uint32_t flags, int32_t width, int32_t height,
-        int32_t refresh) { /* NOP */ }
+        int32_t refresh) {
+    struct display_output *output = data;
+    // Paces hidden surface detection
+    if (flags & WL_OUTPUT_MODE_CURRENT)
+        output->refresh = refresh;
+}
 
 static void output_done(void *data, struct wl_output *wl_output) {
     (void)wl_output;
@@ -988,7 +2839,12 @@ static void output_scale(void *data, struct wl_output *wl_output, int32_t scale)
     (void)wl_output;
 
     struct display_output *output = data;
+    if (output->scale == (uint32_t)scale)
+        return;
     output->scale = scale;
+    // Before the first configure there is nothing to resize yet
+    if (output->layer_surface)
+        render_call(refresh_buffer_size, output);
 }
 
 static void output_name(void *data, struct wl_output *wl_output, const char *name) {
@@ -1037,9 +2893,12 @@ static void handle_global(void *data, struct wl_registry *registry, uint32_t nam
     struct wl_state *state = data;
     if (strcmp(interface, wl_compositor_interface.name) == 0) {
         state->compositor = wl_registry_bind(registry, name, &wl_compositor_interface, 4);
+    } else if (strcmp(interface, wl_shm_interface.name) == 0) {
+        state->shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
     } else if (strcmp(interface, wl_output_interface.name) == 0) {
         struct display_output *output = calloc(1, sizeof(struct display_output));
         output->scale = 1; // Default to no scaling
+        output->dynamic_scale = 1.0;
         output->state = state;
         output->wl_name = name;
         output->wl_output = wl_registry_bind(registry, name, &wl_output_interface, 4);
@@ -1048,8 +2907,13 @@ static void handle_global(void *data, struct wl_registry *registry, uint32_t nam
 
     } else if (strcmp(interface, zwlr_layer_shell_v1_interface.name) == 0) {
         state->layer_shell = wl_registry_bind(registry, name, &zwlr_layer_shell_v1_interface, 1);
+    } else if (strcmp(interface, wp_viewporter_interface.name) == 0) {
+        state->viewporter = wl_registry_bind(registry, name, &wp_viewporter_interface, 1);
+    } else if (strcmp(interface, wp_fractional_scale_manager_v1_interface.name) == 0) {
+        state->fractional_scale_manager = wl_registry_bind(registry, name,
+                &wp_fractional_scale_manager_v1_interface, 1);
     }
-    if (halt_info.auto_pause > 1 || halt_info.auto_stop > 1) {
+    if (auto_mode_enabled()) {
         if (strcmp(interface, zwlr_foreign_toplevel_manager_v1_interface.name) == 0) {
             struct zwlr_foreign_toplevel_manager_v1 *toplevel_manager;
             toplevel_manager = wl_registry_bind(registry, name, &zwlr_foreign_toplevel_manager_v1_interface, 3);
@@ -1115,7 +2979,7 @@ static void copy_argv(int argc, char *argv[]) {
 
     int j = 0;
     for (uint i=0; i < argc; i++) {
-        if (strcmp(argv[i], "-Z") == 0) { // Remove hidden opt
+        if (strcmp(argv[i], "-Z") == 0 || strcmp(argv[i], "-P") == 0) { // Remove hidden opts, stopping adds them anew
             i++; // Skip optind
             halt_info.argc -= 2;
         } else {
@@ -1144,6 +3008,19 @@ static void set_watch_lists() {
     halt_info.stoplist = get_watch_list(stop_path);
     free(stop_path);
 
+    // Index both lists for the /proc scanner
+    procwatch_init(&watch_lists);
+    char **lists[] = {halt_info.pauselist, halt_info.stoplist};
+    uint32_t list_bits[] = {WATCH_PAUSELIST, WATCH_STOPLIST};
+    for (uint i=0; i < 2; i++) {
+        for (uint j=0; lists[i] && lists[i][j]; j++) {
+            if (!procwatch_add(&watch_lists, lists[i][j], list_bits[i])) {
+                cflp_error("Failed to add %s to watch list", lists[i][j]);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
     if (VERBOSE && halt_info.pauselist)
         cflp_info("pauselist found and will be monitored");
     if (VERBOSE && halt_info.stoplist)
@@ -1163,6 +3040,13 @@ static void parse_command_line(int argc, char **argv, struct wl_state *state) {
         {"slideshow", required_argument, NULL, 'n'},
         {"layer", required_argument, NULL, 'l'},
         {"mpv-options", required_argument, NULL, 'o'},
+        {"blit-mode", required_argument, NULL, 'b'},
+        {"hibernate", no_argument, NULL, 'k'},
+        {"unpause-delay", required_argument, NULL, 'u'},
+        {"output-threads", no_argument, NULL, 't'},
+        {"render-size", required_argument, NULL, 'r'},
+        {"dynamic-scale", no_argument, NULL, 'g'},
+        {"buffer-format", required_argument, NULL, 'c'},
         {0, 0, 0, 0}
     };
 
@@ -1180,21 +3064,38 @@ static void parse_command_line(int argc, char **argv, struct wl_state *state) {
         "                               Reduces CPU usage seamlessly\n"
         "--auto-stop    -s              Automagically* stop mpv when the wallpaper is hidden\n"
         "                               Reduces CPU/RAM usage more abruptly\n"
-        "--auto-mode    -a <FULL|MAX>   Extend auto-pause/stop to trigger when any window is\n"
+        "--auto-mode    -a <FULL|MAX>   Extend auto-pause/stop to trigger when every output has a window\n"
         "                               <FULL> (fullscreen) or <MAX> (fullscreen/maximized)\n"
         "--slideshow    -n <seconds>    Slideshow mode plays the next video in a playlist every <seconds>\n"
         "                               And passes mpv options \"loop loop-playlist\" for convenience\n"
         "--layer        -l <layer>      Specifies shell surface <layer> to run on (default: background)\n"
         "--mpv-options  -o <\"options\">  Forwards mpv options (Must be enclosed in quotes \"\")\n"
+        "--blit-mode    -b <FIT|FILL|STRETCH>\n"
+        "                               How one shared frame is scaled onto outputs of other sizes\n"
+        "                               (default: FIT)\n"
+        "--hibernate    -k              Stop only mpv in place instead of running a holder program\n"
+        "                               Resumes faster by keeping the wallpaper surfaces alive\n"
+        "--unpause-delay -u <ms>        Wait <ms> after windows stop covering the wallpaper before\n"
+        "                               resuming with auto-mode (default: 500)\n"
+        "--output-threads -t            Draw every output on its own thread with a shared EGL context\n"
+        "                               Lets large outputs swap in parallel\n"
+        "--render-size  -r <WxH|SOURCE> Render at most <WxH> pixels or the video's own size\n"
+        "                               and let the compositor scale it onto the output\n"
+        "--dynamic-scale -g             Lower the render size of outputs that take too long to draw\n"
+        "                               and raise it again once there is time to spare\n"
+        "--buffer-format -c <ARGB|XRGB|RGB565|RGB10>\n"
+        "                               Pixel format of the wallpaper, all but ARGB are opaque\n"
+        "                               and cheaper for the compositor (default: ARGB)\n"
         "\n"
         "* Auto options may vary based on compositor behavior\n"
         "See the man page for more details\n";
 
     char *layer_name;
     int auto_mode = 0;
+    int poster_fd = -1;
 
     int opt;
-    while ((opt = getopt_long(argc, argv, "hdvfpsa:n:l:o:Z:", long_options, NULL)) != -1) {
+    while ((opt = getopt_long(argc, argv, "hdvfpsa:n:l:o:b:ku:tr:gc:Z:P:", long_options, NULL)) != -1) {
 
         switch (opt) {
             case 'h':
@@ -1309,15 +3210,73 @@ static void parse_command_line(int argc, char **argv, struct wl_state *state) {
                 }
                 mpv_options[write_index] = '\0';
                 break;
+            case 'b':
+                if (strcasecmp(optarg, "fit") == 0) BLIT_MODE = BLIT_FIT;
+                else if (strcasecmp(optarg, "fill") == 0) BLIT_MODE = BLIT_FILL;
+                else if (strcasecmp(optarg, "stretch") == 0) BLIT_MODE = BLIT_STRETCH;
+                else {
+                    cflp_error("%s is not a blit mode\n"
+                                      "Your options are: fit, fill and stretch", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'k':
+                HIBERNATE = true;
+                break;
+            case 'u': {
+                char *end;
+                errno = 0;
+                long delay = strtol(optarg, &end, 10);
+                if (errno || end == optarg || *end != '\0' || delay < 0 || delay > UNPAUSE_DELAY_MAX) {
+                    cflp_error("Invalid unpause delay \"%s\", use 0 to %i ms", optarg, UNPAUSE_DELAY_MAX);
+                    exit(EXIT_FAILURE);
+                }
+                UNPAUSE_DELAY = delay;
+                break;
+            }
+            case 't':
+                OUTPUT_THREADS = true;
+                break;
+            case 'r':
+                if (strcasecmp(optarg, "source") == 0) {
+                    RENDER_SOURCE = true;
+                } else if (sscanf(optarg, "%ux%u", &RENDER_WIDTH, &RENDER_HEIGHT) != 2 ||
+                        RENDER_WIDTH == 0 || RENDER_HEIGHT == 0) {
+                    cflp_error("%s is not a render size\n"
+                                      "Use <width>x<height> or source", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'g':
+                DYNAMIC_SCALE = true;
+                break;
+            case 'c':
+                if (strcasecmp(optarg, "argb") == 0) BUFFER_FORMAT = BUFFER_ARGB;
+                else if (strcasecmp(optarg, "xrgb") == 0) BUFFER_FORMAT = BUFFER_XRGB;
+                else if (strcasecmp(optarg, "rgb565") == 0) BUFFER_FORMAT = BUFFER_RGB565;
+                else if (strcasecmp(optarg, "rgb10") == 0) BUFFER_FORMAT = BUFFER_RGB10;
+                else {
+                    cflp_error("%s is not a buffer format\n"
+                                      "Your options are: argb, xrgb, rgb565 and rgb10", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
             case 'Z': // Hidden option to recover video pos after stopping
                 halt_info.save_info = strdup(optarg);
                 break;
+            case 'P': // Hidden option to show the last frame while mpv loads
+                poster_fd = atoi(optarg);
+                break;
         }
     }
 
     if (VERBOSE)
         cflp_info("Verbose Level %i enabled", VERBOSE);
 
+    // Inherited from the holder, but mpv's children must not keep it open
+    if (poster_fd >= 0 && poster_open(&poster, poster_fd))
+        poster_set_inherit(&poster, false);
+
     // Put in auto_mode after loop to allow out of order options
     if (auto_mode != 0) {
         if (halt_info.auto_pause) {
@@ -1362,33 +3321,247 @@ static void parse_command_line(int argc, char **argv, struct wl_state *state) {
 static void check_paper_processes() {
     // Check for other wallpaper process running
     const char *other_wallpapers[] = {"swaybg", "glpaper", "hyprpaper", "wpaperd", "swww-daemon"};
-    char wallpaper_sbuffer[64] = {0};
 
-    for (uint i=0; i < sizeof(other_wallpapers) / sizeof(other_wallpapers[0]); i++) {
-        snprintf(wallpaper_sbuffer, sizeof(wallpaper_sbuffer), "pidof %s > /dev/null", other_wallpapers[i]);
+    struct procwatch paper_watch;
+    procwatch_init(&paper_watch);
+    for (uint i=0; i < sizeof(other_wallpapers) / sizeof(other_wallpapers[0]); i++)
+        procwatch_add(&paper_watch, other_wallpapers[i], 1 << i);
+
+    // Warn once per program, not per process
+    uint32_t warned = 0;
+    procwatch_scan(&paper_watch);
+    for (size_t i=0; i < paper_watch.match_count; i++) {
+        if (warned & paper_watch.matches[i].lists)
+            continue;
+        warned |= paper_watch.matches[i].lists;
+        cflp_warning("%s is running. This may block mpvpaper from being seen.", paper_watch.matches[i].name);
+    }
+    procwatch_finish(&paper_watch);
+}
+
+static void handle_halt(struct reactor_source *source, uint32_t events) {
+    drain_fd(halt_fd);
+}
+
+static void handle_unblock_timer(struct reactor_source *source, uint32_t events) {
+    drain_fd(unblock_timer_fd);
+    if (unblock_pending)
+        unblock_windows();
+}
+
+static void handle_visibility_timer(struct reactor_source *source, uint32_t events) {
+    drain_fd(visibility_timer_fd);
+    check_visibility();
+}
+
+static void handle_watch_timer(struct reactor_source *source, uint32_t events) {
+    drain_fd(watch_state.timer_fd);
+    scan_watch_lists();
+}
+
+// A held back frame is due
+static void handle_frame_timer(struct reactor_source *source, uint32_t events) {
+    drain_fd(frame_timer_fd);
+    render_new_frame();
+}
+
+// MPV is ready to draw a new frame
+static void handle_render_update(struct reactor_source *source, uint32_t events) {
+    drain_fd(wakeup_fd);
+
+    // mpv is gone while hibernating
+    if (!mpv_glcontext)
+        return;
+
+    uint64_t update_flags = mpv_render_context_update(mpv_glcontext);
+    frame_stats.updates++;
 
-        if (!system(wallpaper_sbuffer))
-            cflp_warning("%s is running. This may block mpvpaper from being seen.", other_wallpapers[i]);
+    // Nothing new to draw, e.g. only a property changed
+    if (!(update_flags & MPV_RENDER_UPDATE_FRAME)) {
+        frame_stats.skipped++;
+        return;
     }
+    frame_stats.frames++;
+    frame_seq++;
+    shared_render.valid = false;
+
+    // mpv takes over from the posters with its first frame
+    if (awaiting_first_frame) {
+        awaiting_first_frame = false;
+        if (!startup.first_frame) {
+            startup.first_frame = true;
+            log_startup("first frame");
+        }
+        // Drawn for the cache before anything else, mpv may be a few frames further once it is on screen
+        render_cached_posters();
+        poster_finish(&poster);
+        if (VERBOSE)
+            cflp_info("First frame ready, replacing posters");
+    }
+
+    // Playing again while still hidden
+    if (visibility_recheck) {
+        visibility_recheck = false;
+        check_visibility();
+    }
+
+    schedule_frame();
 }
 
-int main(int argc, char **argv) {
-    signal(SIGINT, handle_signal);
-    signal(SIGQUIT, handle_signal);
-    signal(SIGTERM, handle_signal);
+// An output worker presented, catch up on frames held back meanwhile
+static void handle_worker_done(struct reactor_source *source, uint32_t events) {
+    drain_fd(worker_done_fd);
 
-    check_paper_processes();
+    struct display_output *output, *tmp;
+    wl_list_for_each_safe(output, tmp, &render_outputs, render_link) {
+        if (!output->worker || atomic_load(&output->worker->busy))
+            continue;
+        // The poster got replaced by the EGL buffer
+        if (output->poster_buffer && output->worker->presented) {
+            wl_buffer_destroy(output->poster_buffer);
+            output->poster_buffer = NULL;
+        }
+    }
+    wl_list_for_each_safe(output, tmp, &render_outputs, render_link) {
+        if (output->redraw_needed && !output->frame_callback)
+            render(output);
+    }
+}
+
+// Lifecycle work the main thread hands over, see render_call()
+static void handle_render_calls(struct reactor_source *source, uint32_t events) {
+    drain_fd(render_call_fd);
+
+    struct ring_msg msg;
+    while (ring_pop(&render_calls, &msg)) {
+        struct render_call_args *call = msg.data;
+        call->fn(call->data);
+        if (write(render_done_fd, &(uint64_t){1}, sizeof(uint64_t)) < 0)
+            cflp_error("Failed to finish a render call");
+    }
+}
+
+static void handle_render_events(struct reactor_source *source, uint32_t events) {
+    drain_fd(render_event_fd);
+
+    bool cached = false;
+    struct ring_msg msg;
+    while (ring_pop(&render_events, &msg)) {
+        if (msg.type == RENDER_EVENT_SEEN) {
+            halt_info.hibernate_visible = 1;
+            halt_info.revive_requested = 1;
+        } else if (msg.type == RENDER_EVENT_CACHE) {
+            write_cached_poster(msg.data);
+            cached = true;
+        }
+    }
+    if (cached)
+        poster_prune(poster_cache_dir, POSTER_CACHE_MAX);
+    // Also covers a RENDER_EVENT_PAUSE dropped from a full ring, the reasons themselves are never lost
+    apply_pause_state();
+}
+
+// Draws and dispatches frame callbacks, so the main loop never waits on the GPU
+static void *render_thread_main(void *data) {
+    struct wl_state *state = data;
+
+    if (!eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, egl_context))
+        cflp_error("Failed to make context current %s", eglGetErrorString(eglGetError()));
+
+    while (!render_thread_quit) {
+        // Same as the main loop, but only for the events of render_queue
+        // Another reader may have queued events for us meanwhile, they must not wait for an unrelated fd
+        int prepare_read_state = -1;
+        while (render_wayland_source &&
+                (prepare_read_state = wl_display_prepare_read_queue(state->display, render_queue)) != 0) {
+            if (wl_display_dispatch_queue_pending(state->display, render_queue) == -1) {
+                reactor_remove(&render_reactor, render_wayland_source);
+                render_wayland_source = NULL;
+            }
+        }
+
+        if (wl_display_flush(state->display) == -1 && errno != EAGAIN && errno != EPIPE)
+            cflp_warning("Failed to flush the Wayland display");
+
+        if (reactor_poll(&render_reactor, -1) == -1) {
+            if (prepare_read_state == 0)
+                wl_display_cancel_read(state->display);
+            continue;
+        }
+
+        if (prepare_read_state == 0) {
+            if (render_wayland_source->revents & EPOLLIN) {
+                wl_display_read_events(state->display);
+            } else {
+                wl_display_cancel_read(state->display);
+            }
+        }
+        // The main loop exits once the compositor is gone, until then keep serving render calls
+        if (render_wayland_source && wl_display_dispatch_queue_pending(state->display, render_queue) == -1) {
+            reactor_remove(&render_reactor, render_wayland_source);
+            render_wayland_source = NULL;
+        }
+
+        reactor_dispatch(&render_reactor);
+    }
+    return NULL;
+}
+
+static bool start_render_thread(struct wl_state *state) {
+    render_queue = wl_display_create_queue(state->display);
+    render_call_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    render_done_fd = eventfd(0, EFD_CLOEXEC);
+    render_event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    worker_done_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (!render_queue || render_call_fd == -1 || render_done_fd == -1 || render_event_fd == -1 ||
+            worker_done_fd == -1 ||
+            !ring_init(&render_calls, 4) || !ring_init(&render_events, 64))
+        return false;
+
+    // mpv updates and frame timing are handled next to the drawing
+    if (!reactor_init(&render_reactor) ||
+            !(render_wayland_source = reactor_add(&render_reactor, wl_display_get_fd(state->display), EPOLLIN,
+                    NULL, NULL)) ||
+            !reactor_add(&render_reactor, render_call_fd, EPOLLIN, handle_render_calls, NULL) ||
+            !reactor_add(&render_reactor, wakeup_fd, EPOLLIN, handle_render_update, NULL) ||
+            !reactor_add(&render_reactor, frame_timer_fd, EPOLLIN, handle_frame_timer, NULL) ||
+            !reactor_add(&render_reactor, visibility_timer_fd, EPOLLIN, handle_visibility_timer, NULL) ||
+            !reactor_add(&render_reactor, worker_done_fd, EPOLLIN, handle_worker_done, NULL) ||
+            !reactor_add(&reactor, render_event_fd, EPOLLIN, handle_render_events, NULL))
+        return false;
+
+    if (pthread_create(&render_thread, NULL, render_thread_main, state) != 0)
+        return false;
+    render_thread_running = true;
+    return true;
+}
+
+int main(int argc, char **argv) {
+    clock_gettime(CLOCK_MONOTONIC, &startup.start);
+    main_thread = pthread_self();
 
     struct wl_state state = {0};
     wl_list_init(&state.outputs);
     wl_list_init(&state.toplevel_handles);
+    wl_list_init(&render_outputs);
 
     parse_command_line(argc, argv, &state);
     set_watch_lists();
     if (halt_info.auto_stop || halt_info.stoplist)
         copy_argv(argc, argv);
 
-    threads[0] = pthread_self(); // Assign main thread
+    // Blocked before mpv starts its threads so signals only arrive through the signalfd
+    sigset_t exit_signals;
+    sigemptyset(&exit_signals);
+    sigaddset(&exit_signals, SIGINT);
+    sigaddset(&exit_signals, SIGQUIT);
+    sigaddset(&exit_signals, SIGTERM);
+    sigprocmask(SIG_BLOCK, &exit_signals, &old_sigmask);
+    signal_fd = signalfd(-1, &exit_signals, SFD_CLOEXEC | SFD_NONBLOCK);
+    if (signal_fd == -1) {
+        cflp_error("Creating signalfd failed.");
+        return EXIT_FAILURE;
+    }
 
     // Create eventfd for checking render_update_callback()
     wakeup_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK | EFD_SEMAPHORE);
@@ -1396,6 +3569,26 @@ int main(int argc, char **argv) {
         cflp_error("Creating eventfd failed.");
         return EXIT_FAILURE;
     }
+    halt_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (halt_fd == -1) {
+        cflp_error("Creating eventfd failed.");
+        return EXIT_FAILURE;
+    }
+    frame_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    unblock_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    visibility_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (frame_timer_fd == -1 || unblock_timer_fd == -1 || visibility_timer_fd == -1) {
+        cflp_error("Creating timers failed.");
+        return EXIT_FAILURE;
+    }
+
+    if (!reactor_init(&reactor) ||
+            !reactor_add(&reactor, halt_fd, EPOLLIN, handle_halt, NULL) ||
+            !reactor_add(&reactor, signal_fd, EPOLLIN, handle_signal, NULL) ||
+            !reactor_add(&reactor, unblock_timer_fd, EPOLLIN, handle_unblock_timer, NULL)) {
+        cflp_error("Creating event loop failed.");
+        return EXIT_FAILURE;
+    }
 
     // Connect to Wayland compositor
     state.display = wl_display_connect(NULL);
@@ -1406,6 +3599,19 @@ int main(int argc, char **argv) {
     }
     if (VERBOSE)
         cflp_success("Connected to Wayland compositor");
+    main_state = &state;
+    // Read by the main loop itself, see wl_display_prepare_read()
+    wayland_source = reactor_add(&reactor, wl_display_get_fd(state.display), EPOLLIN, NULL, NULL);
+    if (!wayland_source) {
+        cflp_error("Failed to watch the Wayland display");
+        return EXIT_FAILURE;
+    }
+    log_startup("connected");
+
+    // Ask for globals now, the compositor answers while EGL and mpv start up
+    struct wl_registry *registry = wl_display_get_registry(state.display);
+    wl_registry_add_listener(registry, &registry_listener, &state);
+    wl_display_flush(state.display);
 
     // Don't start egl and mpv if just displaying outputs
     if (!SHOW_OUTPUTS) {
@@ -1413,20 +3619,30 @@ int main(int argc, char **argv) {
         init_egl(&state);
         if (VERBOSE)
             cflp_success("EGL initialized");
+        log_startup("EGL initialized");
+
+        if (!start_render_thread(&state)) {
+            cflp_error("Failed to start the render thread");
+            exit_mpvpaper(EXIT_FAILURE);
+        }
+
+        // The file loads in the background from here on
+        init_poster_cache();
+        init_mpv_events();
         init_mpv(&state);
-        init_threads();
         if (VERBOSE)
             cflp_success("MPV initialized");
+        log_startup("mpv started");
     }
 
     // Setup wayland surfaces
-    struct wl_registry *registry = wl_display_get_registry(state.display);
-    wl_registry_add_listener(registry, &registry_listener, &state);
     wl_display_roundtrip(state.display);
     if (state.compositor == NULL || state.layer_shell == NULL) {
         cflp_error("Missing a required Wayland interface");
         return EXIT_FAILURE;
     }
+    if ((RENDER_SOURCE || RENDER_WIDTH) && !state.viewporter)
+        cflp_warning("The compositor can't scale surfaces, rendering at full size");
 
     // Check outputs
     wl_display_roundtrip(state.display);
@@ -1436,73 +3652,69 @@ int main(int argc, char **argv) {
         cflp_error(":/ sorry about this but we can't seem to find any output.");
         return EXIT_FAILURE;
     }
+    log_startup("outputs bound");
+
+    check_paper_processes();
+
+    // Watch lists are checked on the main loop
+    if (halt_info.pauselist || halt_info.stoplist) {
+        watch_state.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+        if (watch_state.timer_fd == -1 ||
+                !reactor_add(&reactor, watch_state.timer_fd, EPOLLIN, handle_watch_timer, NULL)) {
+            cflp_error("Creating watch list timer failed");
+            exit_mpvpaper(EXIT_FAILURE);
+        }
+        scan_watch_lists();
+    }
 
     // Main Loop
     while (true) {
-        struct pollfd fds[2];
-        fds[0].fd = wl_display_get_fd(state.display);
-        fds[0].events = POLLIN;
-        fds[1].fd = wakeup_fd;
-        fds[1].events = POLLIN;
-
-        // First make sure to call wl_display_prepare_read() before poll() to avoid deadlock
-        int wl_display_prepare_read_state = wl_display_prepare_read(state.display);
+        // First make sure to call wl_display_prepare_read() before polling to avoid deadlock
+        // It fails while events are queued, like ones the render thread or EGL read for us, so dispatch those first
+        bool dispatch_failed = false;
+        while (wl_display_prepare_read(state.display) != 0) {
+            if (wl_display_dispatch_pending(state.display) == -1) {
+                dispatch_failed = true;
+                break;
+            }
+        }
+        if (dispatch_failed)
+            break;
 
-        // Next flush just before poll()
-        if (wl_display_flush(state.display) == -1 && errno != EAGAIN)
+        // Next flush just before polling
+        if (wl_display_flush(state.display) == -1 && errno != EAGAIN) {
+            wl_display_cancel_read(state.display);
             break;
+        }
 
-        // Wait for a mpv callback or wl_display event within 10ms
-        if (poll(fds, sizeof(fds) / sizeof(fds[0]), 10) == -1 && errno != EINTR)
+        // Sleep until a mpv callback, wl_display event, timer or halt request arrives
+        if (reactor_poll(&reactor, -1) == -1) {
+            wl_display_cancel_read(state.display);
             break;
+        }
 
-        // If wl_display_prepare_read() was successful as 0
-        if (wl_display_prepare_read_state == 0) {
-            // Read if we have wl_display events after poll()
-            if (fds[0].revents & POLLIN) {
-                wl_display_read_events(state.display);
-            } else { // Otherwise we must cancel the read
-                wl_display_cancel_read(state.display);
-            }
+        // Read if we have wl_display events, before any handler may touch the display
+        if (wayland_source->revents & EPOLLIN) {
+            wl_display_read_events(state.display);
+        } else { // Otherwise we must cancel the read
+            wl_display_cancel_read(state.display);
         }
         // Lastly process wl_display events without blocking
         if (wl_display_dispatch_pending(state.display) == -1)
             break;
 
-        if (halt_info.stop_render_loop) {
-            halt_info.stop_render_loop = 0;
-            sleep(2); // Wait at least 2 secs to be killed
-        }
-
-        // MPV is ready to draw a new frame
-        if (fds[1].revents & POLLIN) {
-            // Empty the eventfd
-            uint64_t tmp;
-            if (read(wakeup_fd, &tmp, sizeof(tmp)) == -1)
-                break;
+        reactor_dispatch(&reactor);
 
-            mpv_render_context_update(mpv_glcontext);
-
-            // Draw frame for all outputs
-            struct display_output *output, *tmp_output;
-            wl_list_for_each_safe(output, tmp_output, &state.outputs, link) {
-                // Redraw immediately if not waiting for frame callback
-                if (output->frame_callback == NULL) {
-                    // Avoid crash when output is destroyed
-                    if (output->egl_window && output->egl_surface) {
-                        if (VERBOSE == 2)
-                            cflp_info("MPV is ready to render the next frame for %s", output->name);
-                        render(output);
-                    }
-                } else {
-                    output->redraw_needed = true;
-                }
-            }
+        if (halt_info.stop_requested) {
+            halt_info.stop_requested = 0;
+            stop_mpvpaper(&state);
+        }
+        if (halt_info.revive_requested) {
+            halt_info.revive_requested = 0;
+            revive_mpvpaper(&state);
         }
     }
 
-    struct display_output *output, *tmp_output;
-    wl_list_for_each_safe(output, tmp_output, &state.outputs, link) { destroy_display_output(output); }
-
-    return EXIT_SUCCESS;
+    // The compositor went away
+    exit_mpvpaper(EXIT_SUCCESS);
 }
@@ -0,0 +1,51 @@
+#include <pause.h>
+
+bool pause_swap_reason(struct pause_state *state, uint32_t reason, bool set) {
+    uint32_t old_reasons = atomic_load(&state->reasons);
+    uint32_t new_reasons;
+    do {
+        new_reasons = set ? old_reasons | reason : old_reasons & ~reason;
+        if (new_reasons == old_reasons)
+            return false;
+    } while (!atomic_compare_exchange_weak(&state->reasons, &old_reasons, new_reasons));
+
+    atomic_fetch_add(&state->changes, 1);
+    return true;
+}
+
+bool pause_next_command(struct pause_state *state, bool *pause) {
+    *pause = atomic_load(&state->reasons) != 0;
+    if (atomic_load(&state->applied) == *pause)
+        return false;
+
+    atomic_store(&state->applied, *pause);
+    atomic_fetch_add(&state->commands, 1);
+    state->replies_pending++;
+    return true;
+}
+
+bool pause_command_done(struct pause_state *state) {
+    return state->replies_pending && --state->replies_pending == 0;
+}
+
+void pause_report(struct pause_state *state, bool paused) {
+    // Changes seen while commands are in flight may be stale, mpv is asked again once it answered all of them
+    // Anything matching what mpv was told is just our own command coming back
+    if (state->replies_pending || atomic_load(&state->applied) == paused)
+        return;
+
+    atomic_store(&state->applied, paused);
+    if (paused) {
+        // User paused
+        if (!(atomic_load(&state->reasons) & ~state->user_reason))
+            pause_swap_reason(state, state->user_reason, true);
+    } else { // Clear paused checks if not paused
+        pause_swap_reason(state, state->user_reason, false);
+    }
+}
+
+void pause_reset(struct pause_state *state) {
+    atomic_store(&state->applied, false);
+    state->replies_pending = 0;
+    pause_swap_reason(state, state->user_reason, false);
+}
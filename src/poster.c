@@ -0,0 +1,190 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <poster.h>
+
+#define PAGE_ALIGN(size) (((size) + 4095) & ~(size_t)4095)
+
+bool poster_create(struct poster *poster, const struct poster_image *images, uint32_t count) {
+    memset(poster, 0, sizeof(struct poster));
+    poster->fd = -1;
+
+    // Lay out the header then every image on its own pages
+    size_t size = PAGE_ALIGN(sizeof(struct poster_header) + count * sizeof(struct poster_image));
+    size_t offsets[count ? count : 1];
+    for (uint32_t i=0; i < count; i++) {
+        offsets[i] = size;
+        size += PAGE_ALIGN((size_t)images[i].width * 4 * images[i].height);
+    }
+    if (size > INT32_MAX)
+        return false;
+
+    // Close on exec so mpv's children never see it, see poster_set_inherit()
+    int fd = memfd_create("mpvpaper-poster", MFD_CLOEXEC);
+    if (fd < 0)
+        return false;
+    if (ftruncate(fd, size) < 0) {
+        close(fd);
+        return false;
+    }
+    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+
+    poster->fd = fd;
+    poster->size = size;
+    poster->header = data;
+    poster->header->magic = POSTER_MAGIC;
+    poster->header->count = count;
+    for (uint32_t i=0; i < count; i++) {
+        struct poster_image *image = &poster->header->images[i];
+        *image = images[i];
+        image->output[POSTER_OUTPUT_LEN - 1] = '\0';
+        image->stride = image->width * 4;
+        image->offset = offsets[i];
+    }
+    return true;
+}
+
+bool poster_set_inherit(const struct poster *poster, bool inherit) {
+    int flags = fcntl(poster->fd, F_GETFD);
+    if (flags < 0)
+        return false;
+    flags = inherit ? flags & ~FD_CLOEXEC : flags | FD_CLOEXEC;
+    return fcntl(poster->fd, F_SETFD, flags) == 0;
+}
+
+bool poster_open(struct poster *poster, int fd) {
+    memset(poster, 0, sizeof(struct poster));
+    poster->fd = -1;
+
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct poster_header) || st.st_size > INT32_MAX)
+        return false;
+
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED)
+        return false;
+
+    // Reject anything that is not a poster file or points outside of it
+    struct poster_header *header = data;
+    bool valid = header->magic == POSTER_MAGIC &&
+        header->count <= (st.st_size - sizeof(struct poster_header)) / sizeof(struct poster_image);
+    for (uint32_t i=0; valid && i < header->count; i++) {
+        const struct poster_image *image = &header->images[i];
+        valid = image->scale > 0 && image->stride >= image->width * 4 &&
+            image->offset + (uint64_t)image->stride * image->height <= (uint64_t)st.st_size;
+    }
+    if (!valid) {
+        munmap(data, st.st_size);
+        return false;
+    }
+
+    poster->fd = fd;
+    poster->size = st.st_size;
+    poster->header = header;
+    return true;
+}
+
+void *poster_pixels(const struct poster *poster, uint32_t index) {
+    return (char *)poster->header + poster->header->images[index].offset;
+}
+
+const struct poster_image *poster_find(const struct poster *poster, const char *output) {
+    if (!poster->header || !output)
+        return NULL;
+
+    for (uint32_t i=0; i < poster->header->count; i++) {
+        if (strncmp(poster->header->images[i].output, output, POSTER_OUTPUT_LEN) == 0)
+            return &poster->header->images[i];
+    }
+    return NULL;
+}
+
+struct wl_buffer *poster_create_buffer(struct poster *poster, struct wl_shm *shm, const struct poster_image *image) {
+    // One pool shared by every output
+    if (!poster->pool)
+        poster->pool = wl_shm_create_pool(shm, poster->fd, poster->size);
+
+    return wl_shm_pool_create_buffer(poster->pool, image->offset, image->width, image->height, image->stride,
+            WL_SHM_FORMAT_XRGB8888);
+}
+
+bool poster_save(const struct poster *poster, const char *path) {
+    char *tmp_path = NULL;
+    if (asprintf(&tmp_path, "%s.%d.tmp", path, getpid()) < 0)
+        return false;
+
+    // Write aside then rename, the old file may still be mapped by a compositor
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    bool saved = fd >= 0;
+    for (size_t done = 0; saved && done < poster->size;) {
+        ssize_t len = write(fd, (const char *)poster->header + done, poster->size - done);
+        saved = len > 0;
+        done += saved ? len : 0;
+    }
+    if (fd >= 0)
+        close(fd);
+    saved = saved && rename(tmp_path, path) == 0;
+    if (!saved)
+        unlink(tmp_path);
+
+    free(tmp_path);
+    return saved;
+}
+
+void poster_prune(const char *dir_path, unsigned int max_files) {
+    DIR *dir = opendir(dir_path);
+    if (!dir)
+        return;
+    int dir_fd = dirfd(dir);
+
+    // Drop the least recently used posters until at most max_files remain
+    while (true) {
+        unsigned int count = 0;
+        char oldest[256] = "";
+        struct timespec oldest_time = {0};
+
+        rewinddir(dir);
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            const char *ext = strrchr(entry->d_name, '.');
+            struct stat st;
+            if (!ext || strcmp(ext, ".poster") != 0 || fstatat(dir_fd, entry->d_name, &st, 0) < 0)
+                continue;
+
+            count++;
+            if (!oldest[0] || st.st_mtim.tv_sec < oldest_time.tv_sec ||
+                    (st.st_mtim.tv_sec == oldest_time.tv_sec && st.st_mtim.tv_nsec < oldest_time.tv_nsec)) {
+                snprintf(oldest, sizeof(oldest), "%s", entry->d_name);
+                oldest_time = st.st_mtim;
+            }
+        }
+
+        if (count <= max_files || unlinkat(dir_fd, oldest, 0) < 0)
+            break;
+    }
+    closedir(dir);
+}
+
+void poster_finish(struct poster *poster) {
+    // Buffers already created keep the pool memory alive in the compositor
+    if (poster->pool)
+        wl_shm_pool_destroy(poster->pool);
+    if (poster->header)
+        munmap(poster->header, poster->size);
+    if (poster->fd >= 0)
+        close(poster->fd);
+
+    memset(poster, 0, sizeof(struct poster));
+    poster->fd = -1;
+}
@@ -0,0 +1,271 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include <procwatch.h>
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434 // Same on every architecture
+#endif
+
+// The kernel truncates /proc/<pid>/comm to TASK_COMM_LEN - 1 characters
+#define COMM_MAX_LEN 15
+
+static uint32_t hash_key(const char *key, size_t len) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i=0; i < len; i++) {
+        hash ^= (unsigned char)key[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static struct procwatch_entry *lookup(const struct procwatch *watch, const char *key, size_t len) {
+    if (!watch->table_size)
+        return NULL;
+
+    uint32_t hash = hash_key(key, len);
+    size_t mask = watch->table_size - 1;
+    for (size_t i = hash & mask; watch->table[i].key; i = (i + 1) & mask) {
+        struct procwatch_entry *entry = &watch->table[i];
+        if (entry->hash == hash && strncmp(entry->key, key, len) == 0 && entry->key[len] == '\0')
+            return entry;
+    }
+    return NULL;
+}
+
+static bool grow_table(struct procwatch *watch) {
+    size_t new_size = watch->table_size ? watch->table_size * 2 : 16;
+    struct procwatch_entry *new_table = calloc(new_size, sizeof(struct procwatch_entry));
+    if (!new_table)
+        return false;
+
+    // Rehash old entries
+    for (size_t i=0; i < watch->table_size; i++) {
+        struct procwatch_entry *entry = &watch->table[i];
+        if (!entry->key)
+            continue;
+        size_t j = entry->hash & (new_size - 1);
+        while (new_table[j].key)
+            j = (j + 1) & (new_size - 1);
+        new_table[j] = *entry;
+    }
+
+    free(watch->table);
+    watch->table = new_table;
+    watch->table_size = new_size;
+    return true;
+}
+
+static bool add_key(struct procwatch *watch, const char *key, size_t len, const char *name, uint32_t lists) {
+    struct procwatch_entry *entry = lookup(watch, key, len);
+    if (entry) {
+        entry->lists |= lists;
+        return true;
+    }
+
+    // Keep the load factor under half
+    if ((watch->entry_count + 1) * 2 > watch->table_size && !grow_table(watch))
+        return false;
+
+    uint32_t hash = hash_key(key, len);
+    size_t i = hash & (watch->table_size - 1);
+    while (watch->table[i].key)
+        i = (i + 1) & (watch->table_size - 1);
+
+    entry = &watch->table[i];
+    entry->key = strndup(key, len);
+    entry->name = strdup(name);
+    if (!entry->key || !entry->name) {
+        free(entry->key);
+        free(entry->name);
+        entry->key = NULL;
+        entry->name = NULL;
+        return false;
+    }
+    entry->hash = hash;
+    entry->lists = lists;
+    watch->entry_count++;
+    return true;
+}
+
+void procwatch_init(struct procwatch *watch) {
+    memset(watch, 0, sizeof(struct procwatch));
+}
+
+bool procwatch_add(struct procwatch *watch, const char *name, uint32_t lists) {
+    // Programs are matched by their executable name only
+    const char *key = strrchr(name, '/');
+    key = key ? key + 1 : name;
+
+    size_t len = strlen(key);
+    if (len == 0)
+        return true;
+    if (!add_key(watch, key, len, name, lists))
+        return false;
+
+    // Long names can only ever be seen truncated in comm
+    if (len > COMM_MAX_LEN)
+        return add_key(watch, key, COMM_MAX_LEN, name, lists);
+
+    return true;
+}
+
+static bool add_match(struct procwatch *watch, pid_t pid, const struct procwatch_entry *entry) {
+    if (watch->match_count == watch->match_alloc) {
+        size_t new_alloc = watch->match_alloc ? watch->match_alloc * 2 : 8;
+        struct procwatch_match *new_matches = realloc(watch->matches, new_alloc * sizeof(struct procwatch_match));
+        if (!new_matches)
+            return false;
+        watch->matches = new_matches;
+        watch->match_alloc = new_alloc;
+    }
+
+    watch->matches[watch->match_count++] = (struct procwatch_match){pid, entry->name, entry->lists};
+    return true;
+}
+
+static const struct procwatch_entry *match_pid(const struct procwatch *watch, const char *pid_dir) {
+    char path[64];
+    char buf[4096];
+
+    // Try the process name first
+    snprintf(path, sizeof(path), "/proc/%s/comm", pid_dir);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        ssize_t len = read(fd, buf, sizeof(buf) - 1);
+        close(fd);
+        if (len > 0 && buf[len - 1] == '\n')
+            len--;
+        if (len > 0) {
+            const struct procwatch_entry *entry = lookup(watch, buf, len);
+            if (entry)
+                return entry;
+        }
+    }
+
+    // Then the executable, comm can be renamed by the process itself
+    snprintf(path, sizeof(path), "/proc/%s/exe", pid_dir);
+    ssize_t len = readlink(path, buf, sizeof(buf) - 1);
+    if (len <= 0)
+        return NULL;
+    buf[len] = '\0';
+
+    // Replaced executables are suffixed with " (deleted)"
+    const char DELETED[] = " (deleted)";
+    size_t deleted_len = sizeof(DELETED) - 1;
+    if ((size_t)len > deleted_len && strcmp(buf + len - deleted_len, DELETED) == 0) {
+        len -= deleted_len;
+        buf[len] = '\0';
+    }
+
+    const char *base = strrchr(buf, '/');
+    base = base ? base + 1 : buf;
+    return lookup(watch, base, strlen(base));
+}
+
+size_t procwatch_scan(struct procwatch *watch) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    watch->match_count = 0;
+    watch->procs_scanned = 0;
+
+    DIR *dir = opendir("/proc");
+    if (!dir)
+        return 0;
+
+    pid_t self = getpid();
+    struct dirent *dir_entry;
+    while ((dir_entry = readdir(dir)) != NULL) {
+        // Only numeric entries are processes
+        char *end_ptr;
+        long pid = strtol(dir_entry->d_name, &end_ptr, 10);
+        if (*end_ptr != '\0' || pid <= 0 || pid == self)
+            continue;
+
+        watch->procs_scanned++;
+
+        const struct procwatch_entry *entry = match_pid(watch, dir_entry->d_name);
+        if (entry && !add_match(watch, pid, entry))
+            break;
+    }
+    closedir(dir);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    watch->scan_usec = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
+
+    return watch->match_count;
+}
+
+void procwatch_finish(struct procwatch *watch) {
+    for (size_t i=0; i < watch->table_size; i++) {
+        free(watch->table[i].key);
+        free(watch->table[i].name);
+    }
+    free(watch->table);
+    free(watch->matches);
+    procwatch_init(watch);
+}
+
+int procwatch_pidfd_open(pid_t pid) {
+    return syscall(SYS_pidfd_open, pid, 0);
+}
+
+bool procwatch_track(struct procwatch_procs *procs, const struct procwatch *watch) {
+    for (size_t i=0; i < watch->match_count; i++) {
+        const struct procwatch_match *match = &watch->matches[i];
+
+        bool known = false;
+        for (size_t j=0; j < procs->count && !known; j++)
+            known = procs->procs[j].pid == match->pid;
+        if (known)
+            continue;
+
+        if (procs->count == procs->alloc) {
+            size_t new_alloc = procs->alloc ? procs->alloc * 2 : 8;
+            struct procwatch_proc *new_procs = realloc(procs->procs, new_alloc * sizeof(struct procwatch_proc));
+            if (!new_procs)
+                return false;
+            procs->procs = new_procs;
+            procs->alloc = new_alloc;
+        }
+
+        int pidfd = procwatch_pidfd_open(match->pid);
+        // Already gone
+        if (pidfd < 0 && errno == ESRCH)
+            continue;
+
+        procs->procs[procs->count++] = (struct procwatch_proc){match->pid, pidfd, match->lists, match->name, NULL};
+    }
+    return true;
+}
+
+void procwatch_untrack(struct procwatch_procs *procs, size_t index) {
+    if (procs->procs[index].pidfd >= 0)
+        close(procs->procs[index].pidfd);
+    procs->procs[index] = procs->procs[--procs->count];
+}
+
+void procwatch_untrack_unwatched(struct procwatch_procs *procs) {
+    // Walk backwards so removal only moves already checked entries
+    for (size_t i = procs->count; i-- > 0;) {
+        if (procs->procs[i].pidfd < 0)
+            procwatch_untrack(procs, i);
+    }
+}
+
+bool procwatch_has_unwatched(const struct procwatch_procs *procs) {
+    for (size_t i=0; i < procs->count; i++) {
+        if (procs->procs[i].pidfd < 0)
+            return true;
+    }
+    return false;
+}
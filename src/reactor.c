@@ -0,0 +1,93 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include <reactor.h>
+
+static void free_removed(struct reactor *reactor) {
+    while (reactor->removed) {
+        struct reactor_source *next = reactor->removed->next_removed;
+        free(reactor->removed);
+        reactor->removed = next;
+    }
+}
+
+bool reactor_init(struct reactor *reactor) {
+    memset(reactor, 0, sizeof(struct reactor));
+    reactor->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    return reactor->epoll_fd >= 0;
+}
+
+struct reactor_source *reactor_add(struct reactor *reactor, int fd, uint32_t events, reactor_handler handler,
+        void *data) {
+
+    // Room for every source to be ready at once
+    if (reactor->source_count == reactor->ready_alloc) {
+        int new_alloc = reactor->ready_alloc ? reactor->ready_alloc * 2 : 16;
+        struct reactor_source **new_ready = realloc(reactor->ready, new_alloc * sizeof(struct reactor_source *));
+        if (!new_ready)
+            return NULL;
+        reactor->ready = new_ready;
+        reactor->ready_alloc = new_alloc;
+    }
+
+    struct reactor_source *source = calloc(1, sizeof(struct reactor_source));
+    if (!source)
+        return NULL;
+    source->fd = fd;
+    source->handler = handler;
+    source->data = data;
+
+    struct epoll_event event = {.events = events, .data.ptr = source};
+    if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        free(source);
+        return NULL;
+    }
+    reactor->source_count++;
+    return source;
+}
+
+void reactor_remove(struct reactor *reactor, struct reactor_source *source) {
+    if (!source || source->removed)
+        return;
+
+    epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, source->fd, NULL);
+    reactor->source_count--;
+
+    // Events of this round may still point at it
+    source->removed = true;
+    source->revents = 0;
+    source->next_removed = reactor->removed;
+    reactor->removed = source;
+}
+
+int reactor_poll(struct reactor *reactor, int timeout) {
+    reactor->ready_count = 0;
+    free_removed(reactor);
+
+    struct epoll_event events[reactor->ready_alloc ? reactor->ready_alloc : 1];
+    int count = epoll_wait(reactor->epoll_fd, events, reactor->ready_alloc ? reactor->ready_alloc : 1, timeout);
+    if (count < 0)
+        return errno == EINTR ? 0 : -1;
+
+    for (int i=0; i < count; i++) {
+        struct reactor_source *source = events[i].data.ptr;
+        source->revents = events[i].events;
+        reactor->ready[reactor->ready_count++] = source;
+    }
+    return count;
+}
+
+void reactor_dispatch(struct reactor *reactor) {
+    // Handlers may remove any source, including ones not run yet
+    for (int i=0; i < reactor->ready_count; i++) {
+        struct reactor_source *source = reactor->ready[i];
+        uint32_t revents = source->revents;
+        source->revents = 0;
+        if (!source->removed && revents && source->handler)
+            source->handler(source, revents);
+    }
+    reactor->ready_count = 0;
+}
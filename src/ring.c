@@ -0,0 +1,46 @@
+#include <stdlib.h>
+
+#include <ring.h>
+
+bool ring_init(struct ring *ring, size_t capacity) {
+    size_t size = 1;
+    while (size < capacity)
+        size *= 2;
+
+    ring->msgs = calloc(size, sizeof(struct ring_msg));
+    if (!ring->msgs)
+        return false;
+    ring->mask = size - 1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    return true;
+}
+
+void ring_finish(struct ring *ring) {
+    free(ring->msgs);
+    ring->msgs = NULL;
+}
+
+bool ring_push(struct ring *ring, struct ring_msg msg) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail > ring->mask)
+        return false;
+
+    ring->msgs[head & ring->mask] = msg;
+    // Publishes the message to the consumer
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return true;
+}
+
+bool ring_pop(struct ring *ring, struct ring_msg *msg) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (tail == head)
+        return false;
+
+    *msg = ring->msgs[tail & ring->mask];
+    // Hands the slot back to the producer
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return true;
+}
@@ -0,0 +1,83 @@
+#include <stdlib.h>
+
+#include <cflogprinter.h>
+#include <window.h>
+
+bool output_set_add(struct output_set *set, struct wl_output *output) {
+    // Compositors may send enter again for an output the window is already on
+    for (size_t i=0; i < set->count; i++) {
+        if (set->outputs[i] == output)
+            return false;
+    }
+
+    if (set->count == set->alloc) {
+        size_t new_alloc = set->alloc ? set->alloc * 2 : 2;
+        struct wl_output **new_outputs = realloc(set->outputs, new_alloc * sizeof(struct wl_output *));
+        if (!new_outputs) {
+            cflp_error("Failed to reallocate window outputs");
+            return false;
+        }
+        set->outputs = new_outputs;
+        set->alloc = new_alloc;
+    }
+    set->outputs[set->count++] = output;
+    return true;
+}
+
+void output_set_remove(struct output_set *set, struct wl_output *output) {
+    for (size_t i = set->count; i-- > 0;) {
+        if (set->outputs[i] == output)
+            set->outputs[i] = set->outputs[--set->count];
+    }
+}
+
+void window_output_enter(struct window_state *window, struct wl_output *output) {
+    if (output_set_add(&window->pending_outputs, output))
+        window->changed = true;
+}
+
+void window_output_leave(struct window_state *window, struct wl_output *output) {
+    output_set_remove(&window->pending_outputs, output);
+    window->changed = true;
+}
+
+void window_set_blocking(struct window_state *window, bool blocking) {
+    if (window->pending_blocking != blocking) {
+        window->pending_blocking = blocking;
+        window->changed = true;
+    }
+}
+
+bool window_commit(struct window_state *window, window_block_fn block, void *data) {
+    if (!window->changed)
+        return false;
+    window->changed = false;
+
+    // Cover before uncovering so an output the window stays on is never seen as visible
+    if (window->pending_blocking) {
+        for (size_t i=0; i < window->pending_outputs.count; i++)
+            block(data, window->pending_outputs.outputs[i], true);
+    }
+    if (window->is_blocking) {
+        for (size_t i=0; i < window->outputs.count; i++)
+            block(data, window->outputs.outputs[i], false);
+    }
+
+    window->is_blocking = window->pending_blocking;
+    window->outputs.count = 0;
+    if (window->is_blocking) {
+        for (size_t i=0; i < window->pending_outputs.count; i++)
+            output_set_add(&window->outputs, window->pending_outputs.outputs[i]);
+    }
+    return true;
+}
+
+void window_forget_output(struct window_state *window, struct wl_output *output) {
+    output_set_remove(&window->pending_outputs, output);
+    output_set_remove(&window->outputs, output);
+}
+
+void window_finish(struct window_state *window) {
+    free(window->pending_outputs.outputs);
+    free(window->outputs.outputs);
+}
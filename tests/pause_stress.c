@@ -0,0 +1,205 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <pause.h>
+
+// Hammers pause reasons from several threads while one applier talks to a fake mpv like mpvpaper's main loop
+// The fake mpv answers on its own thread and reports pause changes with the value they had back then
+
+#define SETTERS 2 // Few enough that every reason is often clear at once
+#define TOGGLES 200000
+#define REASON_USER (1u << 31)
+
+static struct pause_state state = {.user_reason = REASON_USER};
+static atomic_int setters_running = SETTERS;
+static pthread_barrier_t start;
+
+// Applier -> mpv
+#define QUEUE_SIZE 1024
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool commands[QUEUE_SIZE];
+    size_t head, tail;
+    bool quit;
+} to_mpv = {.lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER};
+
+// mpv -> applier
+enum { EVENT_REPLY, EVENT_PROPERTY };
+static struct {
+    pthread_mutex_t lock;
+    struct { int type; bool paused; } events[QUEUE_SIZE * 2];
+    size_t head, tail;
+} from_mpv = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static atomic_bool mpv_paused = false; // What mpv_get_property() would return
+static unsigned long commands_sent = 0;
+static bool last_sent = false;
+
+static void fail(const char *msg) {
+    fprintf(stderr, "%s\n", msg);
+    exit(EXIT_FAILURE);
+}
+
+static void push_event(int type, bool paused) {
+    pthread_mutex_lock(&from_mpv.lock);
+    if (from_mpv.head - from_mpv.tail == QUEUE_SIZE * 2)
+        fail("mpv event queue overflowed");
+    from_mpv.events[from_mpv.head % (QUEUE_SIZE * 2)].type = type;
+    from_mpv.events[from_mpv.head % (QUEUE_SIZE * 2)].paused = paused;
+    from_mpv.head++;
+    pthread_mutex_unlock(&from_mpv.lock);
+}
+
+// Someone else pausing or resuming mpv, like a keybinding
+static void user_pause(bool paused) {
+    if (atomic_exchange(&mpv_paused, paused) != paused)
+        push_event(EVENT_PROPERTY, paused);
+}
+
+static void *fake_mpv(void *data) {
+    (void)data;
+    pthread_mutex_lock(&to_mpv.lock);
+    while (true) {
+        while (to_mpv.head == to_mpv.tail && !to_mpv.quit)
+            pthread_cond_wait(&to_mpv.cond, &to_mpv.lock);
+        if (to_mpv.head == to_mpv.tail)
+            break;
+        bool pause = to_mpv.commands[to_mpv.tail++ % QUEUE_SIZE];
+        pthread_mutex_unlock(&to_mpv.lock);
+
+        // Commands run in order, the change is reported before the reply
+        user_pause(pause);
+        push_event(EVENT_REPLY, pause);
+        pthread_mutex_lock(&to_mpv.lock);
+    }
+    pthread_mutex_unlock(&to_mpv.lock);
+    return NULL;
+}
+
+static void *toggle_reason(void *data) {
+    uint32_t reason = 1u << (uintptr_t)data;
+    unsigned long *swaps = calloc(1, sizeof(unsigned long));
+    pthread_barrier_wait(&start);
+    for (int i=0; i < TOGGLES; i++) {
+        // Each thread owns its reason, so every first swap must win and every repeat must lose
+        bool set = i % 2 == 0;
+        *swaps += pause_swap_reason(&state, reason, set);
+        if (pause_swap_reason(&state, reason, set))
+            fail("A reason was swapped twice");
+        // An odd period lets the applier see the reason set as often as cleared
+        if (i % 61 == 0)
+            sched_yield();
+    }
+    atomic_fetch_sub(&setters_running, 1);
+    return swaps;
+}
+
+// One round of mpvpaper's main loop, false once nothing is left to do
+static bool apply() {
+    bool busy = false;
+
+    // Like handle_mpv_events()
+    pthread_mutex_lock(&from_mpv.lock);
+    while (from_mpv.tail != from_mpv.head) {
+        int type = from_mpv.events[from_mpv.tail % (QUEUE_SIZE * 2)].type;
+        bool paused = from_mpv.events[from_mpv.tail % (QUEUE_SIZE * 2)].paused;
+        from_mpv.tail++;
+        pthread_mutex_unlock(&from_mpv.lock);
+        if (type == EVENT_REPLY) {
+            if (pause_command_done(&state))
+                pause_report(&state, atomic_load(&mpv_paused));
+        } else {
+            pause_report(&state, paused);
+        }
+        busy = true;
+        pthread_mutex_lock(&from_mpv.lock);
+    }
+    pthread_mutex_unlock(&from_mpv.lock);
+
+    // Like apply_pause_state()
+    bool pause;
+    if (pause_next_command(&state, &pause)) {
+        if (commands_sent && pause == last_sent)
+            fail("Pause command sent twice in a row");
+        last_sent = pause;
+        commands_sent++;
+
+        pthread_mutex_lock(&to_mpv.lock);
+        if (to_mpv.head - to_mpv.tail == QUEUE_SIZE)
+            fail("mpv command queue overflowed");
+        to_mpv.commands[to_mpv.head++ % QUEUE_SIZE] = pause;
+        pthread_cond_signal(&to_mpv.cond);
+        pthread_mutex_unlock(&to_mpv.lock);
+        busy = true;
+    }
+    return busy || state.replies_pending;
+}
+
+// Every pause reason must end up applied, mpv paused exactly when any reason is left
+static void check_settled(const char *when, uint32_t expected_reasons) {
+    while (apply())
+        sched_yield();
+
+    uint32_t reasons = atomic_load(&state.reasons);
+    bool paused = atomic_load(&mpv_paused);
+    if (reasons != expected_reasons || paused != (reasons != 0) || atomic_load(&state.applied) != paused) {
+        fprintf(stderr, "%s: reasons 0x%x (expected 0x%x), mpv %s, applied %s\n", when, reasons, expected_reasons,
+                paused ? "paused" : "playing", atomic_load(&state.applied) ? "paused" : "playing");
+        exit(EXIT_FAILURE);
+    }
+}
+
+int main() {
+    pthread_t mpv_thread;
+    pthread_create(&mpv_thread, NULL, fake_mpv, NULL);
+
+    pthread_t threads[SETTERS];
+    pthread_barrier_init(&start, NULL, SETTERS);
+    for (uintptr_t i=0; i < SETTERS; i++)
+        pthread_create(&threads[i], NULL, toggle_reason, (void *)i);
+
+    while (atomic_load(&setters_running) > 0)
+        apply();
+
+    unsigned long swaps = 0;
+    for (int i=0; i < SETTERS; i++) {
+        unsigned long *thread_swaps;
+        pthread_join(threads[i], (void **)&thread_swaps);
+        swaps += *thread_swaps;
+        free(thread_swaps);
+    }
+    if (swaps != (unsigned long)SETTERS * TOGGLES || atomic_load(&state.changes) != swaps) {
+        fprintf(stderr, "Lost reason changes: %lu swaps, %lu counted, %lu expected\n", swaps,
+                atomic_load(&state.changes), (unsigned long)SETTERS * TOGGLES);
+        return EXIT_FAILURE;
+    }
+    // Stale pause reports must not have been taken for the user's
+    check_settled("After the storm", 0);
+    unsigned long storm_commands = commands_sent;
+
+    // The user is never overruled, reasons coming and going leave a user pause alone
+    user_pause(true);
+    check_settled("User paused", REASON_USER);
+    pause_swap_reason(&state, 1, true);
+    check_settled("Reason added while user paused", REASON_USER | 1);
+    pause_swap_reason(&state, 1, false);
+    check_settled("Reason cleared while user paused", REASON_USER);
+    user_pause(false);
+    check_settled("User resumed", 0);
+    if (commands_sent != storm_commands)
+        fail("mpv was told to pause or resume although the user had");
+    if (commands_sent != atomic_load(&state.commands))
+        fail("Pause commands were miscounted");
+
+    pthread_mutex_lock(&to_mpv.lock);
+    to_mpv.quit = true;
+    pthread_cond_signal(&to_mpv.cond);
+    pthread_mutex_unlock(&to_mpv.lock);
+    pthread_join(mpv_thread, NULL);
+
+    printf("%lu reason changes, %lu pause commands\n", swaps, commands_sent);
+    return EXIT_SUCCESS;
+}
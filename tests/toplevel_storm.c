@@ -0,0 +1,100 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <window.h>
+
+// Replays synthetic foreign toplevel event storms, like a workspace switch with hundreds of windows
+
+#define WINDOWS 1000
+#define OUTPUTS 3
+#define STORMS 200
+
+struct fake_output {
+    unsigned int blocking_windows;
+};
+
+static struct fake_output outputs[OUTPUTS];
+static unsigned long block_calls = 0;
+
+static void block_output(void *data, struct wl_output *wl_output, bool blocking) {
+    (void)data;
+    struct fake_output *output = (struct fake_output *)wl_output;
+    if (blocking)
+        output->blocking_windows++;
+    else if (output->blocking_windows > 0)
+        output->blocking_windows--;
+    block_calls++;
+}
+
+static int64_t monotonic_nsec() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+int main() {
+    struct window_state *windows = calloc(WINDOWS, sizeof(struct window_state));
+    int *window_outputs = calloc(WINDOWS, sizeof(int)); // Index of the output each window is on
+    if (!windows || !window_outputs)
+        return EXIT_FAILURE;
+
+    // Every window starts on one output
+    for (int i=0; i < WINDOWS; i++) {
+        window_outputs[i] = i % OUTPUTS;
+        window_output_enter(&windows[i], (struct wl_output *)&outputs[window_outputs[i]]);
+        window_commit(&windows[i], block_output, NULL);
+    }
+
+    unsigned long events = 0;
+    int64_t start = monotonic_nsec();
+    for (int storm=0; storm < STORMS; storm++) {
+        // Every window reports a state, some also move to the next output or get their output resent, then done
+        bool fullscreen = storm % 2 == 0;
+        for (int i=0; i < WINDOWS; i++) {
+            struct window_state *window = &windows[i];
+            if (i % 10 == storm % 10) {
+                window_output_leave(window, (struct wl_output *)&outputs[window_outputs[i]]);
+                window_outputs[i] = (window_outputs[i] + 1) % OUTPUTS;
+                window_output_enter(window, (struct wl_output *)&outputs[window_outputs[i]]);
+                events += 2;
+            } else if (i % 10 == (storm + 5) % 10) {
+                window_output_enter(window, (struct wl_output *)&outputs[window_outputs[i]]);
+                events++;
+            }
+            window_set_blocking(window, fullscreen);
+            window_commit(window, block_output, NULL);
+            events += 2;
+        }
+    }
+    int64_t elapsed = monotonic_nsec() - start;
+
+    // Storms end unblocked, every counter must be back at zero
+    int failed = 0;
+    for (int i=0; i < OUTPUTS; i++) {
+        if (outputs[i].blocking_windows != 0) {
+            fprintf(stderr, "Output %i still has %u blocking windows\n", i, outputs[i].blocking_windows);
+            failed = 1;
+        }
+    }
+    // Each window is on exactly the output it moved to last, and covers none
+    for (int i=0; i < WINDOWS; i++) {
+        const struct output_set *pending = &windows[i].pending_outputs;
+        if (pending->count != 1 || pending->outputs[0] != (struct wl_output *)&outputs[window_outputs[i]] ||
+                windows[i].outputs.count != 0) {
+            fprintf(stderr, "Window %i is on %zu outputs and covers %zu\n", i, pending->count, windows[i].outputs.count);
+            failed = 1;
+            break;
+        }
+    }
+
+    printf("%lu events in %.2f ms, %.1f ns per event, %lu output updates\n", events, elapsed / 1e6,
+            (double)elapsed / events, block_calls);
+
+    for (int i=0; i < WINDOWS; i++)
+        window_finish(&windows[i]);
+    free(windows);
+    free(window_outputs);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}